@@ -1,18 +1,77 @@
+#define _GNU_SOURCE
 #include "openalloc.h"
+#include "openalloc_inline.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <time.h>
 #include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <linux/perf_event.h>
 
 #define HEAP_SIZE (1024 * 1024)
 static unsigned char heap[HEAP_SIZE];
 
+#define LARGE_HEAP_SIZE (128 * 1024 * 1024)
+static unsigned char large_heap[LARGE_HEAP_SIZE];
+
 static double get_time_seconds(void) {
     struct timespec ts;
     clock_gettime(CLOCK_MONOTONIC, &ts);
     return ts.tv_sec + ts.tv_nsec * 1e-9;
 }
 
+// Hardware event counter for this thread, or -1 where perf events are
+// unavailable (containers, VMs without a PMU).
+static int perf_counter_open(uint32_t type, uint64_t config) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = type;
+    attr.size = sizeof(attr);
+    attr.config = config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static int cache_miss_counter_open(void) {
+    return perf_counter_open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+}
+
+static int dtlb_miss_counter_open(void) {
+    return perf_counter_open(PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB |
+                             (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                             (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+}
+
+static void cache_miss_counter_start(int fd) {
+    if (fd < 0) return;
+    ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+    ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+}
+
+static long long cache_miss_counter_stop(int fd) {
+    long long count = -1;
+    if (fd < 0) return -1;
+    ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+    if (read(fd, &count, sizeof(count)) != sizeof(count)) return -1;
+    return count;
+}
+
+static void print_cache_misses(long long misses, int ops) {
+    if (misses < 0) {
+        printf(", cache misses n/a\n");
+    } else {
+        printf(", %.3f cache misses per op\n", (double)misses / ops);
+    }
+}
+
 static void benchmark_small_allocations(void) {
     printf("Benchmark: Small allocations (16 bytes)...\n");
     
@@ -55,6 +114,137 @@ static void benchmark_medium_allocations(void) {
     printf("  %.2f ns per allocation\n", (end - start) * 1e9 / iterations);
 }
 
+static void benchmark_const_size(void) {
+    printf("Benchmark: Constant-size alloc/free (32 bytes)...\n");
+    
+    const int iterations = 1000000;
+    void* ptrs[64];
+    
+    double start = get_time_seconds();
+    for (int i = 0; i < iterations; i += 64) {
+        for (int j = 0; j < 64; j++) ptrs[j] = openalloc_malloc(32);
+        for (int j = 0; j < 64; j++) openalloc_free(ptrs[j]);
+    }
+    double end = get_time_seconds();
+    printf("  openalloc_malloc:       %.2f ns per alloc/free\n", (end - start) * 1e9 / iterations);
+    
+    start = get_time_seconds();
+    for (int i = 0; i < iterations; i += 64) {
+        for (int j = 0; j < 64; j++) ptrs[j] = openalloc_malloc_const(32);
+        for (int j = 0; j < 64; j++) openalloc_free(ptrs[j]);
+    }
+    end = get_time_seconds();
+    printf("  openalloc_malloc_const: %.2f ns per alloc/free\n", (end - start) * 1e9 / iterations);
+}
+
+static void benchmark_guard_sampling(void) {
+    printf("Benchmark: Guard-page sampling (64-byte alloc/free)...\n");
+    
+    const int iterations = 1000000;
+    const size_t rates[] = {0, 100000, 10000, 1000};
+    void* ptrs[64];
+    
+    for (size_t r = 0; r < sizeof(rates) / sizeof(rates[0]); r++) {
+        openalloc_init(heap, HEAP_SIZE);
+        if (openalloc_set_guard_sample_rate(rates[r]) != 0) {
+            printf("  skipped (guard pages unsupported)\n");
+            return;
+        }
+        
+        double start = get_time_seconds();
+        for (int i = 0; i < iterations; i += 64) {
+            for (int j = 0; j < 64; j++) ptrs[j] = openalloc_malloc(64);
+            for (int j = 0; j < 64; j++) openalloc_free(ptrs[j]);
+        }
+        double end = get_time_seconds();
+        
+        if (rates[r]) {
+            printf("  1 in %-6zu %.2f ns per alloc/free\n", rates[r], (end - start) * 1e9 / iterations);
+        } else {
+            printf("  off         %.2f ns per alloc/free\n", (end - start) * 1e9 / iterations);
+        }
+    }
+    openalloc_set_guard_sample_rate(0);
+}
+
+static void benchmark_limits(void) {
+    printf("Benchmark: Heap limit accounting (64-byte alloc/free)...\n");
+    
+    const int iterations = 1000000;
+    const char* names[] = {"no limits:", "under limits:", "past soft:"};
+    void* ptrs[64];
+    
+    // Every openalloc_malloc and openalloc_free updates the usage count;
+    // with limits set each malloc also compares it, and past the soft limit
+    // each one goes through the out-of-line check.
+    for (int mode = 0; mode < 3; mode++) {
+        openalloc_init(heap, HEAP_SIZE);
+        size_t soft = mode == 2 ? 1 : mode == 1 ? HEAP_SIZE : 0;
+        if (openalloc_set_limits(soft, mode ? 2 * HEAP_SIZE : 0) != 0) {
+            printf("  skipped (heap limits unsupported)\n");
+            return;
+        }
+        if (mode == 2) {
+            ptrs[0] = openalloc_malloc(64);
+            openalloc_free(ptrs[0]);
+        }
+        
+        double start = get_time_seconds();
+        for (int i = 0; i < iterations; i += 64) {
+            for (int j = 0; j < 64; j++) ptrs[j] = openalloc_malloc(64);
+            for (int j = 0; j < 64; j++) openalloc_free(ptrs[j]);
+        }
+        double mid = get_time_seconds();
+        for (int i = 0; i < iterations; i += 64) {
+            for (int j = 0; j < 64; j++) ptrs[j] = openalloc_malloc_const(64);
+            for (int j = 0; j < 64; j++) openalloc_free(ptrs[j]);
+        }
+        double end = get_time_seconds();
+        
+        printf("  %-14s %.2f ns malloc, %.2f ns malloc_const per alloc/free\n", names[mode],
+               (mid - start) * 1e9 / iterations, (end - mid) * 1e9 / iterations);
+    }
+    openalloc_init(heap, HEAP_SIZE);
+}
+
+static void benchmark_tags(void) {
+    printf("Benchmark: Allocation tags (32-256 byte alloc/free)...\n");
+    
+    const int iterations = 1000000;
+    const char* names[] = {"untagged:", "openalloc_set_tag:", "malloc_tagged:"};
+    void* ptrs[64];
+    
+    for (int mode = 0; mode < 3; mode++) {
+        openalloc_init(heap, HEAP_SIZE);
+        if (mode == 1 && openalloc_set_tag(1) != 0) {
+            printf("  skipped (allocation tags unsupported)\n");
+            return;
+        }
+        
+        double start = get_time_seconds();
+        for (int i = 0; i < iterations; i += 64) {
+            for (int j = 0; j < 64; j++) {
+                size_t size = (size_t)32 << (j & 3);
+                ptrs[j] = mode == 2 ? openalloc_malloc_tagged(size, 1 + j % 4) : openalloc_malloc(size);
+            }
+            for (int j = 0; j < 64; j++) openalloc_free(ptrs[j]);
+        }
+        double end = get_time_seconds();
+        openalloc_set_tag(0);
+        printf("  %-19s %.2f ns per alloc/free\n", names[mode], (end - start) * 1e9 / iterations);
+    }
+    
+    // What a dashboard pays to read every tag.
+    openalloc_tag_stats_t stats;
+    double start = get_time_seconds();
+    for (int i = 0; i < 100000; i++) {
+        openalloc_get_tag_stats(1 + i % (OPENALLOC_MAX_TAGS - 1), &stats);
+    }
+    double end = get_time_seconds();
+    printf("  openalloc_get_tag_stats: %.2f ns per call\n", (end - start) * 1e9 / 100000);
+    openalloc_init(heap, HEAP_SIZE);
+}
+
 static void benchmark_free(void) {
     printf("Benchmark: Free operations...\n");
     
@@ -137,6 +327,631 @@ static void benchmark_fragmentation(void) {
     printf("  %.2f ns per alloc/free\n", (end - start) * 1e9 / iterations);
 }
 
+// One run of the mixed-lifetime workload on a growable heap: each request
+// allocates and frees a handful of buffers, about one in three replaces an
+// entry in a long-lived cache, and every 50th leaves a permanent object.
+// Hint 0 is a plain openalloc_malloc. Returns the heap size the run grew to, which is also its peak.
+static size_t lifetime_run(int hinted, int requests) {
+    if (openalloc_init_growable(1024 * 1024) != 0) return 0;
+    const int cache_size = 4000;
+    void** cache = calloc(cache_size, sizeof(void*));
+    void* bufs[8];
+    srand(42);
+    for (int r = 0; r < requests; r++) {
+        for (int i = 0; i < 8; i++) {
+            size_t size = 256 + (size_t)(rand() % 4096);
+            bufs[i] = openalloc_malloc_hint(size, hinted ? OPENALLOC_HINT_SHORT : 0);
+            if (bufs[i]) memset(bufs[i], i, size);
+        }
+        if (rand() % 3 == 0) {
+            int k = rand() % cache_size;
+            size_t size = 64 + (size_t)(rand() % 448);
+            openalloc_free(cache[k]);
+            cache[k] = openalloc_malloc_hint(size, hinted ? OPENALLOC_HINT_LONG : 0);
+        }
+        if (r % 50 == 0) openalloc_malloc_hint(128, hinted ? OPENALLOC_HINT_PERMANENT : 0);
+        for (int i = 0; i < 8; i++) openalloc_free(bufs[i]);
+    }
+    free(cache);
+    
+    openalloc_stats_t stats;
+    openalloc_get_stats(&stats);
+    return stats.heap_size;
+}
+
+// Peak footprint of the mixed-lifetime workload with every allocation from
+// the one heap and with each one hinted by its lifetime.
+static void benchmark_lifetime_hints(void) {
+    printf("Benchmark: Mixed-lifetime footprint (1 MiB segments)...\n");
+    
+    const int requests = 5000;
+    for (int hinted = 0; hinted <= 1; hinted++) {
+        double start = get_time_seconds();
+        size_t peak = lifetime_run(hinted, requests);
+        double end = get_time_seconds();
+        if (peak == 0) {
+            printf("  skipped (growable heap unsupported)\n");
+            return;
+        }
+        printf("  %-8s %6zu KiB peak heap, %.2f us per request\n", hinted ? "hinted:" : "plain:",
+               peak / 1024, (end - start) * 1e6 / requests);
+    }
+}
+
+// Teardown of many live objects, freed in allocation order and in random
+// order, once straight into the bins and once through the deferred queue.
+static void benchmark_batch_free(void) {
+    const int count = 200000;
+    printf("Benchmark: Batch free of %d objects (teardown)...\n", count);
+    
+    if (openalloc_set_deferred_free(1) != 0) {
+        printf("  skipped (deferred free unsupported)\n");
+        return;
+    }
+    openalloc_set_deferred_free(0);
+    
+    void** ptrs = malloc(count * sizeof(void*));
+    int fd = cache_miss_counter_open();
+    
+    for (int shuffled = 0; shuffled <= 1; shuffled++) {
+        for (int deferred = 0; deferred <= 1; deferred++) {
+            openalloc_init(large_heap, LARGE_HEAP_SIZE);
+            srand(42);
+            for (int i = 0; i < count; i++) {
+                ptrs[i] = openalloc_malloc((size_t)(rand() % 256 + 16));
+            }
+            for (int i = count - 1; shuffled && i > 0; i--) {
+                int j = rand() % (i + 1);
+                void* tmp = ptrs[i];
+                ptrs[i] = ptrs[j];
+                ptrs[j] = tmp;
+            }
+            
+            openalloc_set_deferred_free(deferred);
+            
+            cache_miss_counter_start(fd);
+            double start = get_time_seconds();
+            for (int i = 0; i < count; i++) {
+                openalloc_free(ptrs[i]);
+            }
+            openalloc_flush();
+            double end = get_time_seconds();
+            long long misses = cache_miss_counter_stop(fd);
+            
+            printf("  %-8s %-8s %6.2f ns per free", shuffled ? "random" : "in-order",
+                   deferred ? "deferred" : "direct", (end - start) * 1e9 / count);
+            print_cache_misses(misses, count);
+            openalloc_set_deferred_free(0);
+        }
+    }
+    
+    if (fd >= 0) close(fd);
+    free(ptrs);
+}
+
+// Requests that walk a whole bin: ~500k free blocks scattered over a 100 MB
+// heap, none big enough, so every step of the walk is a dependent load to a
+// random address.
+static void benchmark_fragmented_search(void) {
+    const int blocks = 500000;
+    const int searches = 20;
+    printf("Benchmark: Free-list search on a fragmented heap (%d free blocks)...\n", blocks);
+    
+#ifdef OPENALLOC_NO_SEG
+    // One coalescing list: setup alone would take minutes at this size.
+    printf("  skipped (no-seg allocator)\n");
+    return;
+#endif
+    
+    void** ptrs = malloc(blocks * sizeof(void*));
+    openalloc_init(large_heap, LARGE_HEAP_SIZE);
+    srand(7);
+    for (int i = 0; i < blocks; i++) {
+        ptrs[i] = openalloc_malloc((size_t)(rand() % 64 + 129));
+        openalloc_malloc(16);
+    }
+    for (int i = blocks - 1; i > 0; i--) {
+        int j = rand() % (i + 1);
+        void* tmp = ptrs[i];
+        ptrs[i] = ptrs[j];
+        ptrs[j] = tmp;
+    }
+    for (int i = 0; i < blocks; i++) {
+        openalloc_free(ptrs[i]);
+    }
+    
+    int fd = cache_miss_counter_open();
+    cache_miss_counter_start(fd);
+    double start = get_time_seconds();
+    for (int i = 0; i < searches; i++) {
+        openalloc_malloc(256);
+    }
+    double end = get_time_seconds();
+    long long misses = cache_miss_counter_stop(fd);
+    
+    long long visited = (long long)searches * blocks;
+    printf("  walk: %.2f ns per block visited", (end - start) * 1e9 / visited);
+    print_cache_misses(misses, (int)visited);
+    
+    // Then pop the whole bin: each request takes the head, and the caller
+    // touches its object before asking again.
+    const int pops = blocks - 1000;
+    cache_miss_counter_start(fd);
+    start = get_time_seconds();
+    for (int i = 0; i < pops; i++) {
+        uint64_t* obj = openalloc_malloc(128);
+        obj[0] = obj[15] = (uint64_t)i;
+    }
+    end = get_time_seconds();
+    misses = cache_miss_counter_stop(fd);
+    
+    printf("  pop:  %.2f ns per allocation", (end - start) * 1e9 / pops);
+    print_cache_misses(misses, pops);
+    
+    if (fd >= 0) close(fd);
+    free(ptrs);
+}
+
+// AnonHugePages of this process in KiB, or -1 if smaps_rollup is missing.
+static long anon_huge_kb(void) {
+    FILE* f = fopen("/proc/self/smaps_rollup", "r");
+    if (!f) return -1;
+    char line[128];
+    long kb = -1;
+    while (fgets(line, sizeof(line), f)) {
+        if (sscanf(line, "AnonHugePages: %ld kB", &kb) == 1) break;
+    }
+    fclose(f);
+    return kb;
+}
+
+// Pointer chase through a shuffled list of small nodes spread over a 64 MB
+// growable heap, on 4 KiB pages and then with huge pages, counting dTLB
+// load misses where perf events are available.
+static void benchmark_huge_pages(void) {
+    printf("Benchmark: Pointer chase over 1M 48-byte nodes (dTLB)...\n");
+    
+    const int count = 1000000;
+    const int passes = 5;
+    void** nodes = malloc(count * sizeof(void*));
+    int fd = dtlb_miss_counter_open();
+    
+    for (int huge = 0; huge <= 1; huge++) {
+        long huge_before = anon_huge_kb();
+        if (openalloc_init_growable(0) != 0 || openalloc_set_huge_pages(huge) != 0) {
+            printf("  skipped (huge pages unsupported)\n");
+            break;
+        }
+        
+        for (int i = 0; i < count; i++) nodes[i] = openalloc_malloc(48);
+        srand(7);
+        for (int i = count - 1; i > 0; i--) {
+            int j = rand() % (i + 1);
+            void* tmp = nodes[i];
+            nodes[i] = nodes[j];
+            nodes[j] = tmp;
+        }
+        for (int i = 0; i < count; i++) *(void**)nodes[i] = nodes[(i + 1) % count];
+        
+        void* p = nodes[0];
+        cache_miss_counter_start(fd);
+        double start = get_time_seconds();
+        for (long i = 0; i < (long)count * passes; i++) p = *(void**)p;
+        double end = get_time_seconds();
+        long long misses = cache_miss_counter_stop(fd);
+        
+        printf("  %-11s %.2f ns per hop", huge ? "huge pages" : "4 KiB pages", (end - start) * 1e9 / ((double)count * passes));
+        if (misses < 0) {
+            printf(", dTLB misses n/a");
+        } else {
+            printf(", %.3f dTLB misses per hop", (double)misses / ((double)count * passes));
+        }
+        long huge_after = anon_huge_kb();
+        if (huge_before >= 0 && huge_after >= 0) printf(", %ld KiB on THP", huge_after - huge_before);
+        printf("%s\n", p == NULL ? " (broken list)" : "");
+    }
+    openalloc_init(heap, HEAP_SIZE);
+    
+    if (fd >= 0) close(fd);
+    free(nodes);
+}
+
+// usable_size and free over a shuffled heap much larger than the cache, with
+// objects in headered blocks and then in header-free slabs, where the size
+// class comes from the page map instead of the line in front of each object.
+struct pnode {
+    size_t next;
+    size_t value;
+};
+
+// Builds a linked list in a file-backed heap, then compares reopening it
+// with openalloc_attach against rebuilding it from scratch.
+static void benchmark_persistent(void) {
+    printf("Benchmark: Persistent heap reopen (1M list nodes)...\n");
+    
+    const size_t size = 64 * 1024 * 1024;
+    const int count = 1000000;
+    FILE* file = tmpfile();
+    if (!file || ftruncate(fileno(file), size) != 0) {
+        printf("  skipped (no temp file)\n");
+        if (file) fclose(file);
+        return;
+    }
+    uint8_t* base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fileno(file), 0);
+    if (base == MAP_FAILED || openalloc_init_persistent(base, size) != 0) {
+        printf("  skipped (persistent heap unsupported)\n");
+        if (base != MAP_FAILED) munmap(base, size);
+        fclose(file);
+        return;
+    }
+    
+    double start = get_time_seconds();
+    size_t head = 0;
+    for (int i = 0; i < count; i++) {
+        struct pnode* n = openalloc_malloc(sizeof(*n));
+        n->next = head;
+        n->value = (size_t)i;
+        head = (size_t)((uint8_t*)n - base);
+    }
+    openalloc_set_root(base + head);
+    double built = get_time_seconds();
+    openalloc_detach();
+    munmap(base, size);
+    double detached = get_time_seconds();
+    
+    base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fileno(file), 0);
+    int ret = openalloc_attach(base, size);
+    struct pnode* n = openalloc_get_root();
+    size_t sum = 0;
+    for (; n; n = n->next ? (struct pnode*)(base + n->next) : NULL) sum += n->value;
+    double walked = get_time_seconds();
+    
+    printf("  build:            %.2f ms\n", (built - start) * 1e3);
+    printf("  detach:           %.2f ms\n", (detached - built) * 1e3);
+    printf("  attach and walk:  %.2f ms%s\n", (walked - detached) * 1e3,
+           ret == 0 && sum == (size_t)count * (count - 1) / 2 ? "" : " (list lost)");
+    
+    // Reopening without a detach pays for a block walk to rebuild the bins.
+    munmap(base, size);
+    base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fileno(file), 0);
+    start = get_time_seconds();
+    ret = openalloc_attach(base, size);
+    double end = get_time_seconds();
+    printf("  recovery attach:  %.2f ms%s\n", (end - start) * 1e3, ret == 1 ? "" : " (not recovered)");
+    
+    openalloc_detach();
+    munmap(base, size);
+    fclose(file);
+}
+
+// Producer side of benchmark_shared_handoff, run in a child process: every
+// message is filled in full, then sent over out either as its bytes or, with
+// a shared heap, as its offset.
+static void handoff_producer(int out, int heap_fd, size_t heap_size, int count, size_t msg_size) {
+    uint8_t* msg = NULL;
+    if (heap_fd >= 0) {
+        uint8_t* base = mmap(NULL, heap_size, PROT_READ | PROT_WRITE, MAP_SHARED, heap_fd, 0);
+        if (base == MAP_FAILED || openalloc_attach_shared(base, heap_size) != 0) _exit(1);
+    } else {
+        msg = malloc(msg_size);
+    }
+
+    for (int i = 0; i < count; i++) {
+        if (heap_fd >= 0 && !(msg = openalloc_malloc(msg_size))) _exit(1);
+        memset(msg, i & 0xff, msg_size);
+
+        size_t offset = openalloc_ptr_to_offset(msg);
+        const uint8_t* data = heap_fd >= 0 ? (const uint8_t*)&offset : msg;
+        size_t len = heap_fd >= 0 ? sizeof(offset) : msg_size;
+        for (size_t sent = 0; sent < len;) {
+            ssize_t n = write(out, data + sent, len - sent);
+            if (n <= 0) _exit(1);
+            sent += (size_t)n;
+        }
+    }
+    _exit(0);
+}
+
+static int read_full(int fd, void* buf, size_t len) {
+    for (size_t got = 0; got < len;) {
+        ssize_t n = read(fd, (uint8_t*)buf + got, len - got);
+        if (n <= 0) return -1;
+        got += (size_t)n;
+    }
+    return 0;
+}
+
+// Message passing between processes: copying each message through a
+// socket against allocating it in a shared heap and passing its offset.
+static void benchmark_shared_handoff(void) {
+    printf("Benchmark: Cross-process message handoff (64 KiB messages)...\n");
+
+    const int count = 20000;
+    const size_t msg_size = 64 * 1024;
+    const size_t heap_size = 256 * 1024 * 1024;
+    int heap_fd = memfd_create("openalloc-bench", MFD_CLOEXEC);
+    uint8_t* base = MAP_FAILED;
+    if (heap_fd >= 0 && ftruncate(heap_fd, heap_size) == 0) {
+        base = mmap(NULL, heap_size, PROT_READ | PROT_WRITE, MAP_SHARED, heap_fd, 0);
+    }
+    if (base == MAP_FAILED || openalloc_init_shared(base, heap_size) != 0) {
+        printf("  skipped (shared heap unsupported)\n");
+        if (base != MAP_FAILED) munmap(base, heap_size);
+        if (heap_fd >= 0) close(heap_fd);
+        return;
+    }
+    uint8_t* buf = malloc(msg_size);
+
+    for (int shared = 0; shared <= 1; shared++) {
+        int fds[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) break;
+        double start = get_time_seconds();
+        pid_t pid = fork();
+        if (pid == 0) {
+            close(fds[0]);
+            handoff_producer(fds[1], shared ? heap_fd : -1, heap_size, count, msg_size);
+        }
+        close(fds[1]);
+
+        // The consumer reads a byte per cache line of every message.
+        size_t sum = 0;
+        int received = 0;
+        for (; received < count; received++) {
+            const uint8_t* msg = buf;
+            size_t offset;
+            if (shared) {
+                if (read_full(fds[0], &offset, sizeof(offset)) != 0) break;
+                msg = openalloc_offset_to_ptr(offset);
+            } else if (read_full(fds[0], buf, msg_size) != 0) {
+                break;
+            }
+            for (size_t j = 0; j < msg_size; j += 64) sum += msg[j];
+            if (shared) openalloc_free((void*)msg);
+        }
+        int status = 0;
+        waitpid(pid, &status, 0);
+        double end = get_time_seconds();
+        close(fds[0]);
+
+        int ok = received == count && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+        printf("  %-15s %.2f us per message, %.2f GB/s%s\n", shared ? "shared offset:" : "socket copy:",
+               (end - start) * 1e6 / count, (double)count * msg_size / (end - start) / 1e9,
+               ok ? "" : " (failed)");
+        if (sum == 0) printf("  (empty messages)\n");
+    }
+
+    free(buf);
+    openalloc_detach();
+    munmap(base, heap_size);
+    close(heap_fd);
+}
+
+// Tries count allocations of size at once and frees them again.
+static int large_successes(int count, size_t size) {
+    void* ptrs[100];
+    int ok = 0;
+    for (int i = 0; i < count; i++) {
+        if ((ptrs[ok] = openalloc_malloc(size)) != NULL) ok++;
+    }
+    for (int i = 0; i < ok; i++) openalloc_free(ptrs[i]);
+    return ok;
+}
+
+// A fragmentation storm over handle blocks, then a compaction pass in
+// 1 ms steps, measuring how many of 100 256 KiB allocations succeed.
+static void benchmark_compaction(void) {
+    printf("Benchmark: Compaction after a fragmentation storm (32 MiB heap)...\n");
+    
+    openalloc_init(large_heap, 32 * 1024 * 1024);
+    const int max_handles = 400000;
+    openalloc_handle_t* handles = malloc(max_handles * sizeof(openalloc_handle_t));
+    int count = 0;
+    srand(42);
+    while (count < max_handles && (handles[count] = openalloc_halloc(32 + (size_t)(rand() % 480))) != 0) {
+        count++;
+    }
+    if (count == 0) {
+        printf("  skipped (handles unsupported)\n");
+        free(handles);
+        return;
+    }
+    for (int i = 0; i < count; i++) {
+        if (rand() % 2) openalloc_hfree(handles[i]);
+    }
+    
+    openalloc_stats_t stats;
+    openalloc_get_stats(&stats);
+    printf("  %d handles, %zu KiB free in %zu blocks\n", count, stats.total_freed / 1024, stats.free_blocks);
+    printf("  before:     %3d/100 large allocations\n", large_successes(100, 256 * 1024));
+    
+    int steps = 0;
+    double longest = 0;
+    double start = get_time_seconds();
+    for (int more = 1; more; steps++) {
+        double step_start = get_time_seconds();
+        more = openalloc_compact(1000);
+        double step = get_time_seconds() - step_start;
+        if (step > longest) longest = step;
+    }
+    double end = get_time_seconds();
+    
+    openalloc_get_stats(&stats);
+    printf("  compacted:  %3d/100 large allocations, %zu free blocks\n",
+           large_successes(100, 256 * 1024), stats.free_blocks);
+    printf("  %d steps of 1 ms budget, longest %.2f ms, %.2f ms total\n", steps, longest * 1e3, (end - start) * 1e3);
+    free(handles);
+}
+
+static int compare_doubles(const void* a, const void* b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+// The first requests on a fresh heap (a new anonymous mapping each run, as
+// a static array is on first touch), each filled in, with no warm-up, with
+// openalloc_prefault, and with openalloc_prefault plus openalloc_reserve.
+static void benchmark_cold_start(void) {
+    printf("Benchmark: First requests on a fresh heap (64-512 bytes)...\n");
+    
+    const int count = 20000;
+    const size_t heap_size = 64 * 1024 * 1024;
+    const size_t sizes[] = {64, 128, 256, 512};
+    const char* names[] = {"cold:", "prefault:", "prefault+reserve:"};
+    double* lat = malloc(count * sizeof(double));
+    
+    for (int mode = 0; mode < 3; mode++) {
+        uint8_t* mem = mmap(NULL, heap_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mem == MAP_FAILED) break;
+        openalloc_init(mem, heap_size);
+        
+        double warm_start = get_time_seconds();
+        int warm_ok = 1;
+        if (mode >= 1) warm_ok &= openalloc_prefault() == 0;
+        for (int k = 0; mode == 2 && k < 4; k++) {
+            warm_ok &= openalloc_reserve(sizes[k], count / 4 + 1) == 0;
+        }
+        double warm = get_time_seconds() - warm_start;
+        if (!warm_ok) {
+            printf("  skipped (warm-up unsupported)\n");
+            munmap(mem, heap_size);
+            break;
+        }
+        
+        srand(42);
+        for (int i = 0; i < count; i++) {
+            size_t size = sizes[rand() % 4];
+            double start = get_time_seconds();
+            uint8_t* p = openalloc_malloc(size);
+            if (p) memset(p, i & 0xff, size);
+            lat[i] = get_time_seconds() - start;
+        }
+        
+        double total = 0;
+        for (int i = 0; i < count; i++) total += lat[i];
+        qsort(lat, count, sizeof(double), compare_doubles);
+        printf("  %-18s mean %6.1f ns, p99 %6.1f ns, max %7.1f us (warm-up %.1f ms)\n", names[mode],
+               total * 1e9 / count, lat[count * 99 / 100] * 1e9, lat[count - 1] * 1e6, warm * 1e3);
+        munmap(mem, heap_size);
+    }
+    free(lat);
+}
+
+// KiB of [mem, mem + size) resident in memory.
+static size_t resident_kb(void* mem, size_t size) {
+    size_t pages = size / 4096;
+    unsigned char* vec = malloc(pages);
+    size_t resident = 0;
+    if (vec && mincore(mem, size, vec) == 0) {
+        for (size_t i = 0; i < pages; i++) resident += vec[i] & 1;
+    }
+    free(vec);
+    return resident * 4;
+}
+
+// Random replacement churn over a 64 MiB heap, mostly small blocks with
+// an occasional large one, with no maintenance and with a background pass
+// every 10 ms. Reports per-operation latency, free blocks left behind and
+// resident memory at the end.
+static void benchmark_background(void) {
+    printf("Benchmark: Churn with background maintenance (64 MiB heap)...\n");
+    
+    const int ops = 100000;
+    const int slots = 20000;
+    const size_t heap_size = 64 * 1024 * 1024;
+    void** live = calloc(slots, sizeof(void*));
+    double* lat = malloc(ops * sizeof(double));
+    
+    for (int mode = 0; mode <= 1; mode++) {
+        uint8_t* mem = mmap(NULL, heap_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mem == MAP_FAILED) break;
+        openalloc_init(mem, heap_size);
+        if (mode == 1 && openalloc_start_background(10) != 0) {
+            printf("  skipped (background maintenance unsupported)\n");
+            munmap(mem, heap_size);
+            break;
+        }
+        
+        memset(live, 0, slots * sizeof(void*));
+        srand(42);
+        for (int i = 0; i < ops; i++) {
+            int k = rand() % slots;
+            size_t size = rand() % 1000 ? 16 + (size_t)(rand() % 2048) : 64 * 1024 + (size_t)(rand() % (192 * 1024));
+            double start = get_time_seconds();
+            openalloc_free(live[k]);
+            live[k] = openalloc_malloc(size);
+            lat[i] = get_time_seconds() - start;
+            if (live[k]) memset(live[k], i & 0xff, size < 256 ? size : 256);
+        }
+        
+        // The last passes run after the churn stops.
+        if (mode == 1) {
+            struct timespec pause = {0, 50 * 1000000};
+            nanosleep(&pause, NULL);
+            openalloc_stop_background();
+        }
+        openalloc_stats_t stats;
+        openalloc_get_stats(&stats);
+        size_t resident = resident_kb(mem, heap_size);
+        
+        double total = 0;
+        for (int i = 0; i < ops; i++) total += lat[i];
+        qsort(lat, ops, sizeof(double), compare_doubles);
+        printf("  %-12s mean %5.1f ns, p99.9 %6.1f ns, max %7.1f us; %6zu free blocks, %6zu KiB resident\n",
+               mode ? "background:" : "inline:", total * 1e9 / ops, lat[ops - ops / 1000] * 1e9,
+               lat[ops - 1] * 1e6, stats.free_blocks, resident);
+        munmap(mem, heap_size);
+    }
+    free(lat);
+    free(live);
+}
+
+static void benchmark_cold_free(void) {
+    printf("Benchmark: Cold usable_size/free (32-byte objects, random order)...\n");
+    
+    const int count = 1000000;
+    void** ptrs = malloc(count * sizeof(void*));
+    int fd = cache_miss_counter_open();
+    
+    for (int slabs = 0; slabs <= 1; slabs++) {
+        openalloc_init(large_heap, LARGE_HEAP_SIZE);
+        if (openalloc_set_slab_max(slabs ? 32 : 0) != 0) {
+            printf("  skipped (slabs unsupported)\n");
+            break;
+        }
+        
+        for (int i = 0; i < count; i++) ptrs[i] = openalloc_malloc(32);
+        srand(42);
+        for (int i = count - 1; i > 0; i--) {
+            int j = rand() % (i + 1);
+            void* tmp = ptrs[i];
+            ptrs[i] = ptrs[j];
+            ptrs[j] = tmp;
+        }
+        
+        size_t total = 0;
+        cache_miss_counter_start(fd);
+        double start = get_time_seconds();
+        for (int i = 0; i < count; i++) total += openalloc_usable_size(ptrs[i]);
+        double end = get_time_seconds();
+        long long misses = cache_miss_counter_stop(fd);
+        printf("  %-7s usable_size: %.2f ns", slabs ? "slabs" : "blocks", (end - start) * 1e9 / count);
+        print_cache_misses(misses, count);
+        if (total != (size_t)count * 32) printf("  (unexpected usable size total %zu)\n", total);
+        
+        cache_miss_counter_start(fd);
+        start = get_time_seconds();
+        for (int i = 0; i < count; i++) openalloc_free(ptrs[i]);
+        end = get_time_seconds();
+        misses = cache_miss_counter_stop(fd);
+        printf("  %-7s free:        %.2f ns", slabs ? "slabs" : "blocks", (end - start) * 1e9 / count);
+        print_cache_misses(misses, count);
+    }
+    openalloc_set_slab_max(0);
+    
+    if (fd >= 0) close(fd);
+    free(ptrs);
+}
+
 int main(void) {
     printf("Openalloc Benchmark Suite\n");
     printf("==========================\n\n");
@@ -150,6 +965,19 @@ int main(void) {
     benchmark_medium_allocations();
     printf("\n");
     
+    openalloc_init(heap, HEAP_SIZE);
+    benchmark_const_size();
+    printf("\n");
+    
+    benchmark_guard_sampling();
+    printf("\n");
+    
+    benchmark_limits();
+    printf("\n");
+    
+    benchmark_tags();
+    printf("\n");
+    
     openalloc_init(heap, HEAP_SIZE);
     benchmark_free();
     printf("\n");
@@ -162,6 +990,36 @@ int main(void) {
     benchmark_fragmentation();
     printf("\n");
     
+    benchmark_lifetime_hints();
+    printf("\n");
+    
+    benchmark_batch_free();
+    printf("\n");
+    
+    benchmark_fragmented_search();
+    printf("\n");
+    
+    benchmark_huge_pages();
+    printf("\n");
+    
+    benchmark_persistent();
+    printf("\n");
+    
+    benchmark_shared_handoff();
+    printf("\n");
+    
+    benchmark_compaction();
+    printf("\n");
+    
+    benchmark_cold_start();
+    printf("\n");
+    
+    benchmark_background();
+    printf("\n");
+    
+    benchmark_cold_free();
+    printf("\n");
+    
     openalloc_stats_t stats;
     openalloc_get_stats(&stats);
     printf("Final Stats:\n");
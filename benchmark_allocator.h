@@ -0,0 +1,18 @@
+#ifndef BENCHMARK_ALLOCATOR_H
+#define BENCHMARK_ALLOCATOR_H
+
+#include <stddef.h>
+
+// Allocator under test, shared by compare_benchmark.c and mt_benchmark.c.
+// ctx is passed back to both calls, e.g. the lock a wrapper serializes on.
+typedef void* (*alloc_func_t)(size_t, void*);
+typedef void (*free_func_t)(void*, void*);
+
+typedef struct {
+    const char* name;
+    alloc_func_t malloc;
+    free_func_t free;
+    void* ctx;
+} allocator_t;
+
+#endif
@@ -1,4 +1,5 @@
 #include "openalloc.h"
+#include "benchmark_allocator.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -36,16 +37,6 @@ static void glibc_free(void* ptr, void* ctx) {
     free(ptr);
 }
 
-typedef void* (*alloc_func_t)(size_t, void*);
-typedef void (*free_func_t)(void*, void*);
-
-typedef struct {
-    const char* name;
-    alloc_func_t malloc;
-    free_func_t free;
-    void* ctx;
-} allocator_t;
-
 static void benchmark_allocator(allocator_t* alloc, const char* test_name, 
                               int iterations, size_t size) {
     double start, end;
@@ -0,0 +1,146 @@
+#include "openalloc.hpp"
+#include <chrono>
+#include <cstdio>
+#include <list>
+#include <map>
+#include <unordered_map>
+#include <vector>
+
+#define VECTOR_ELEMENTS 1000000
+#define VECTOR_ROUNDS 20
+#define MAP_ELEMENTS 200000
+#define LIST_OPS 1000000
+
+static double get_time_seconds() {
+    using clock = std::chrono::steady_clock;
+    return std::chrono::duration<double>(clock::now().time_since_epoch()).count();
+}
+
+template <template <typename> class Alloc>
+struct std_containers {
+    using vector = std::vector<int, Alloc<int>>;
+    using unordered_map = std::unordered_map<int, int, std::hash<int>, std::equal_to<int>,
+                                             Alloc<std::pair<const int, int>>>;
+    using map = std::map<int, int, std::less<int>, Alloc<std::pair<const int, int>>>;
+    using list = std::list<int, Alloc<int>>;
+};
+
+template <typename Vector, typename... Args>
+static double bench_vector(Args&&... args) {
+    double start = get_time_seconds();
+    for (int r = 0; r < VECTOR_ROUNDS; r++) {
+        Vector v(args...);
+        for (int i = 0; i < VECTOR_ELEMENTS; i++) {
+            v.push_back(i);
+        }
+    }
+    return (get_time_seconds() - start) * 1e9 / ((double)VECTOR_ROUNDS * VECTOR_ELEMENTS);
+}
+
+template <typename Map, typename... Args>
+static double bench_unordered_map(Args&&... args) {
+    double start = get_time_seconds();
+    {
+        Map m(args...);
+        for (int i = 0; i < MAP_ELEMENTS; i++) {
+            m.emplace(i * 7919, i);
+        }
+        for (int i = 0; i < MAP_ELEMENTS; i++) {
+            m.erase(i * 7919);
+        }
+    }
+    return (get_time_seconds() - start) * 1e9 / (2.0 * MAP_ELEMENTS);
+}
+
+template <typename Map, typename... Args>
+static double bench_map(Args&&... args) {
+    double start = get_time_seconds();
+    {
+        Map m(args...);
+        for (int i = 0; i < MAP_ELEMENTS; i++) {
+            m.emplace((i * 7919) % MAP_ELEMENTS, i);
+        }
+    }
+    return (get_time_seconds() - start) * 1e9 / MAP_ELEMENTS;
+}
+
+template <typename List, typename... Args>
+static double bench_list(Args&&... args) {
+    double start = get_time_seconds();
+    {
+        List l(args...);
+        for (int i = 0; i < LIST_OPS; i++) {
+            l.push_back(i);
+            if (i % 3 == 2) {
+                l.pop_front();
+                l.pop_front();
+            }
+        }
+    }
+    return (get_time_seconds() - start) * 1e9 / LIST_OPS;
+}
+
+static void print_row(const char* name, double vec, double umap, double map, double list) {
+    printf("%-24s %10.2f ns %10.2f ns %10.2f ns %10.2f ns\n", name, vec, umap, map, list);
+}
+
+template <template <typename> class Alloc>
+static void bench_allocator(const char* name) {
+    using c = std_containers<Alloc>;
+    double vec = bench_vector<typename c::vector>();
+    double umap = bench_unordered_map<typename c::unordered_map>();
+    double map = bench_map<typename c::map>();
+    double list = bench_list<typename c::list>();
+    print_row(name, vec, umap, map, list);
+}
+
+// Resource is a memory_resource type that is default-constructed once per
+// container, so arena and pool runs each start from an empty resource.
+template <typename Resource>
+static void bench_resource(const char* name) {
+    Resource vec_res, umap_res, map_res, list_res;
+    double vec = bench_vector<std::pmr::vector<int>>(&vec_res);
+    double umap = bench_unordered_map<std::pmr::unordered_map<int, int>>(&umap_res);
+    double map = bench_map<std::pmr::map<int, int>>(&map_res);
+    double list = bench_list<std::pmr::list<int>>(&list_res);
+    print_row(name, vec, umap, map, list);
+}
+
+struct new_delete_resource : std::pmr::memory_resource {
+    void* do_allocate(std::size_t bytes, std::size_t alignment) override {
+        return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+    }
+    void do_deallocate(void* ptr, std::size_t bytes, std::size_t alignment) override {
+        std::pmr::new_delete_resource()->deallocate(ptr, bytes, alignment);
+    }
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+        return this == &other;
+    }
+};
+
+int main() {
+    if (openalloc_init_growable(0) != 0) {
+        fprintf(stderr, "openalloc_init_growable failed\n");
+        return 1;
+    }
+
+    printf("\n");
+    printf("╔════════════════════════════════════════════════════════════════════════════╗\n");
+    printf("║                   OpenAlloc C++ Container Benchmark                        ║\n");
+    printf("╚════════════════════════════════════════════════════════════════════════════╝\n");
+    printf("\n");
+    printf("%-24s %13s %13s %13s %13s\n", "Allocator", "vector", "unordered_map", "map", "list");
+    printf("────────────────────────────────────────────────────────────────────────────\n");
+
+    bench_allocator<std::allocator>("std::allocator");
+    bench_allocator<openalloc::allocator>("openalloc::allocator");
+    bench_resource<new_delete_resource>("pmr new_delete");
+    bench_resource<openalloc::memory_resource>("pmr openalloc");
+    bench_resource<openalloc::monotonic_resource>("pmr openalloc monotonic");
+    bench_resource<openalloc::pool_resource>("pmr openalloc pool");
+
+    printf("═════════════════════════════════════════════════════════════════════════════\n");
+    printf("\n");
+
+    return 0;
+}
@@ -0,0 +1,546 @@
+#define _GNU_SOURCE
+#include "openalloc.h"
+#include "benchmark_allocator.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+#define HEAP_SIZE (64 * 1024 * 1024)
+static unsigned char heap[HEAP_SIZE];
+
+#define MAX_THREADS 64
+#define CHURN_OPS 100000
+#define CHURN_SLOTS 1024
+#define QUEUE_DEPTH 256
+#define PRODUCER_OPS 100000
+#define LARSON_SETS_PER_THREAD 4
+#define LARSON_SLOTS 512
+#define LARSON_ROUND 2000
+#define LARSON_ROUNDS 25
+#define PROBE_OBJECTS 256
+#define PROBE_WRITES 2000
+#define CACHE_LINE 64
+#define NUMA_BLOCKS 4096
+#define NUMA_BLOCK_SIZE 4096
+#define NUMA_PASSES 20
+
+static double get_time_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static inline uint32_t rand_next(uint32_t* state) {
+    *state = *state * 1103515245 + 12345;
+    return *state >> 8;
+}
+
+// OpenAlloc has a single unsynchronized heap, so the benchmark serializes
+// it behind one mutex; this is the baseline a concurrent heap has to beat.
+static void* openalloc_locked_malloc(size_t size, void* ctx) {
+    pthread_mutex_t* lock = ctx;
+    pthread_mutex_lock(lock);
+    void* ptr = openalloc_malloc(size);
+    pthread_mutex_unlock(lock);
+    return ptr;
+}
+
+static void openalloc_locked_free(void* ptr, void* ctx) {
+    pthread_mutex_t* lock = ctx;
+    pthread_mutex_lock(lock);
+    openalloc_free(ptr);
+    pthread_mutex_unlock(lock);
+}
+
+static void* glibc_malloc(size_t size, void* ctx) {
+    (void)ctx;
+    return malloc(size);
+}
+
+static void glibc_free(void* ptr, void* ctx) {
+    (void)ctx;
+    free(ptr);
+}
+
+typedef struct {
+    allocator_t* alloc;
+    int thread_id;
+    int num_threads;
+    uint64_t ops;
+    uint64_t failures;
+} worker_t;
+
+typedef double (*pattern_func_t)(allocator_t* alloc, int threads, uint64_t* failures);
+
+static double run_workers(worker_t* workers, int threads, void* (*fn)(void*)) {
+    pthread_t tids[MAX_THREADS * 2];
+    double start = get_time_seconds();
+    for (int i = 0; i < threads; i++) {
+        pthread_create(&tids[i], NULL, fn, &workers[i]);
+    }
+    for (int i = 0; i < threads; i++) {
+        pthread_join(tids[i], NULL);
+    }
+    return get_time_seconds() - start;
+}
+
+// Thread-local churn: every thread allocates and frees its own objects.
+static void* churn_worker(void* arg) {
+    worker_t* w = arg;
+    void* slots[CHURN_SLOTS] = {NULL};
+    uint32_t rng = 0x9e3779b9u * (w->thread_id + 1);
+
+    for (int i = 0; i < CHURN_OPS; i++) {
+        int idx = rand_next(&rng) % CHURN_SLOTS;
+        if (slots[idx]) {
+            w->alloc->free(slots[idx], w->alloc->ctx);
+            slots[idx] = NULL;
+        } else {
+            size_t size = 16 + rand_next(&rng) % 496;
+            slots[idx] = w->alloc->malloc(size, w->alloc->ctx);
+            if (!slots[idx]) w->failures++;
+        }
+        w->ops++;
+    }
+
+    for (int i = 0; i < CHURN_SLOTS; i++) {
+        if (slots[i]) w->alloc->free(slots[i], w->alloc->ctx);
+    }
+    return NULL;
+}
+
+static double pattern_churn(allocator_t* alloc, int threads, uint64_t* failures) {
+    worker_t workers[MAX_THREADS];
+    for (int i = 0; i < threads; i++) {
+        workers[i] = (worker_t){alloc, i, threads, 0, 0};
+    }
+    double elapsed = run_workers(workers, threads, churn_worker);
+
+    uint64_t ops = 0;
+    for (int i = 0; i < threads; i++) {
+        ops += workers[i].ops;
+        *failures += workers[i].failures;
+    }
+    return ops / elapsed;
+}
+
+// Producer/consumer: objects are allocated on one thread and freed on
+// another, handed over through a bounded single-producer queue per pair.
+typedef struct {
+    void* items[QUEUE_DEPTH];
+    volatile unsigned head;
+    volatile unsigned tail;
+    volatile int done;
+} spsc_queue_t;
+
+typedef struct {
+    worker_t base;
+    spsc_queue_t* queue;
+} pair_worker_t;
+
+static void* producer_worker(void* arg) {
+    pair_worker_t* w = arg;
+    spsc_queue_t* q = w->queue;
+    uint32_t rng = 0x85ebca6bu * (w->base.thread_id + 1);
+
+    for (int i = 0; i < PRODUCER_OPS; i++) {
+        void* ptr = w->base.alloc->malloc(16 + rand_next(&rng) % 240, w->base.alloc->ctx);
+        if (!ptr) {
+            w->base.failures++;
+            continue;
+        }
+        while (q->head - q->tail == QUEUE_DEPTH) {
+            sched_yield();
+        }
+        q->items[q->head % QUEUE_DEPTH] = ptr;
+        __atomic_store_n(&q->head, q->head + 1, __ATOMIC_RELEASE);
+        w->base.ops++;
+    }
+    __atomic_store_n(&q->done, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+static void* consumer_worker(void* arg) {
+    pair_worker_t* w = arg;
+    spsc_queue_t* q = w->queue;
+
+    for (;;) {
+        unsigned head = __atomic_load_n(&q->head, __ATOMIC_ACQUIRE);
+        if (q->tail == head) {
+            if (__atomic_load_n(&q->done, __ATOMIC_ACQUIRE) &&
+                q->tail == __atomic_load_n(&q->head, __ATOMIC_ACQUIRE)) {
+                break;
+            }
+            sched_yield();
+            continue;
+        }
+        w->base.alloc->free(q->items[q->tail % QUEUE_DEPTH], w->base.alloc->ctx);
+        __atomic_store_n(&q->tail, q->tail + 1, __ATOMIC_RELEASE);
+        w->base.ops++;
+    }
+    return NULL;
+}
+
+static double pattern_producer_consumer(allocator_t* alloc, int threads, uint64_t* failures) {
+    // threads counts producer/consumer pairs
+    static spsc_queue_t queues[MAX_THREADS];
+    pair_worker_t workers[MAX_THREADS * 2];
+    pthread_t tids[MAX_THREADS * 2];
+
+    for (int i = 0; i < threads; i++) {
+        memset(&queues[i], 0, sizeof(queues[i]));
+        workers[2 * i] = (pair_worker_t){{alloc, i, threads, 0, 0}, &queues[i]};
+        workers[2 * i + 1] = (pair_worker_t){{alloc, i, threads, 0, 0}, &queues[i]};
+    }
+
+    double start = get_time_seconds();
+    for (int i = 0; i < threads; i++) {
+        pthread_create(&tids[2 * i], NULL, producer_worker, &workers[2 * i]);
+        pthread_create(&tids[2 * i + 1], NULL, consumer_worker, &workers[2 * i + 1]);
+    }
+    for (int i = 0; i < threads * 2; i++) {
+        pthread_join(tids[i], NULL);
+    }
+    double elapsed = get_time_seconds() - start;
+
+    uint64_t ops = 0;
+    for (int i = 0; i < threads * 2; i++) {
+        ops += workers[i].base.ops;
+        *failures += workers[i].base.failures;
+    }
+    return ops / elapsed;
+}
+
+// Larson-style migration: slot sets circulate between threads, so most
+// frees hit objects that another thread allocated in an earlier round.
+typedef struct {
+    void* slots[LARSON_SLOTS];
+} slot_set_t;
+
+static slot_set_t larson_sets[MAX_THREADS * LARSON_SETS_PER_THREAD];
+static int larson_free_sets[MAX_THREADS * LARSON_SETS_PER_THREAD];
+static int larson_free_count;
+static pthread_mutex_t larson_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int larson_take(uint32_t* rng) {
+    pthread_mutex_lock(&larson_lock);
+    int pick = rand_next(rng) % larson_free_count;
+    int set = larson_free_sets[pick];
+    larson_free_sets[pick] = larson_free_sets[--larson_free_count];
+    pthread_mutex_unlock(&larson_lock);
+    return set;
+}
+
+static void larson_put(int set) {
+    pthread_mutex_lock(&larson_lock);
+    larson_free_sets[larson_free_count++] = set;
+    pthread_mutex_unlock(&larson_lock);
+}
+
+static void* larson_worker(void* arg) {
+    worker_t* w = arg;
+    uint32_t rng = 0xc2b2ae35u * (w->thread_id + 1);
+
+    for (int round = 0; round < LARSON_ROUNDS; round++) {
+        int set = larson_take(&rng);
+        slot_set_t* set_ptr = &larson_sets[set];
+        for (int i = 0; i < LARSON_ROUND; i++) {
+            int idx = rand_next(&rng) % LARSON_SLOTS;
+            if (set_ptr->slots[idx]) {
+                w->alloc->free(set_ptr->slots[idx], w->alloc->ctx);
+            }
+            set_ptr->slots[idx] = w->alloc->malloc(8 + rand_next(&rng) % 504, w->alloc->ctx);
+            if (!set_ptr->slots[idx]) w->failures++;
+            w->ops++;
+        }
+        larson_put(set);
+    }
+    return NULL;
+}
+
+static double pattern_larson(allocator_t* alloc, int threads, uint64_t* failures) {
+    worker_t workers[MAX_THREADS];
+    int num_sets = threads * LARSON_SETS_PER_THREAD;
+
+    memset(larson_sets, 0, sizeof(slot_set_t) * num_sets);
+    larson_free_count = num_sets;
+    for (int i = 0; i < num_sets; i++) {
+        larson_free_sets[i] = i;
+    }
+
+    for (int i = 0; i < threads; i++) {
+        workers[i] = (worker_t){alloc, i, threads, 0, 0};
+    }
+    double elapsed = run_workers(workers, threads, larson_worker);
+
+    for (int s = 0; s < num_sets; s++) {
+        for (int i = 0; i < LARSON_SLOTS; i++) {
+            if (larson_sets[s].slots[i]) alloc->free(larson_sets[s].slots[i], alloc->ctx);
+        }
+    }
+
+    uint64_t ops = 0;
+    for (int i = 0; i < threads; i++) {
+        ops += workers[i].ops;
+        *failures += workers[i].failures;
+    }
+    return ops / elapsed;
+}
+
+// False-sharing probe: threads allocate small objects in lockstep, then
+// hammer only their own objects. Adjacent objects handed to different
+// threads share cache lines and show up as lost write throughput.
+static void* probe_objects[MAX_THREADS][PROBE_OBJECTS];
+static volatile int probe_turn;
+
+static void* probe_worker(void* arg) {
+    worker_t* w = arg;
+
+    for (int i = 0; i < PROBE_OBJECTS; i++) {
+        while (__atomic_load_n(&probe_turn, __ATOMIC_ACQUIRE) % w->num_threads != w->thread_id) {
+            sched_yield();
+        }
+        probe_objects[w->thread_id][i] = w->alloc->malloc(16, w->alloc->ctx);
+        if (!probe_objects[w->thread_id][i]) w->failures++;
+        __atomic_add_fetch(&probe_turn, 1, __ATOMIC_RELEASE);
+    }
+
+    for (int r = 0; r < PROBE_WRITES; r++) {
+        for (int i = 0; i < PROBE_OBJECTS; i++) {
+            volatile uint64_t* obj = probe_objects[w->thread_id][i];
+            if (obj) (*obj)++;
+            w->ops++;
+        }
+    }
+    return NULL;
+}
+
+static double probe_shared_lines(int threads) {
+    size_t shared = 0;
+    size_t total = 0;
+
+    for (int t = 0; t < threads; t++) {
+        for (int i = 0; i < PROBE_OBJECTS; i++) {
+            uintptr_t line = (uintptr_t)probe_objects[t][i] / CACHE_LINE;
+            if (!probe_objects[t][i]) continue;
+            total++;
+            for (int u = 0; u < threads; u++) {
+                if (u == t) continue;
+                int hit = 0;
+                for (int j = 0; j < PROBE_OBJECTS; j++) {
+                    if (probe_objects[u][j] && (uintptr_t)probe_objects[u][j] / CACHE_LINE == line) {
+                        hit = 1;
+                        break;
+                    }
+                }
+                if (hit) {
+                    shared++;
+                    break;
+                }
+            }
+        }
+    }
+    return total ? 100.0 * shared / total : 0.0;
+}
+
+static double last_shared_pct;
+
+static double pattern_false_sharing(allocator_t* alloc, int threads, uint64_t* failures) {
+    worker_t workers[MAX_THREADS];
+    probe_turn = 0;
+    memset(probe_objects, 0, sizeof(probe_objects));
+
+    for (int i = 0; i < threads; i++) {
+        workers[i] = (worker_t){alloc, i, threads, 0, 0};
+    }
+    double elapsed = run_workers(workers, threads, probe_worker);
+    last_shared_pct = probe_shared_lines(threads);
+
+    for (int t = 0; t < threads; t++) {
+        for (int i = 0; i < PROBE_OBJECTS; i++) {
+            if (probe_objects[t][i]) alloc->free(probe_objects[t][i], alloc->ctx);
+        }
+    }
+
+    uint64_t ops = 0;
+    for (int i = 0; i < threads; i++) {
+        ops += workers[i].ops;
+        *failures += workers[i].failures;
+    }
+    return ops / elapsed;
+}
+
+typedef struct {
+    const char* name;
+    pattern_func_t run;
+} pattern_t;
+
+static void benchmark_pattern(pattern_t* pattern, allocator_t** allocs, int num_allocs,
+                              int* thread_counts, int num_counts) {
+    printf("\n%s\n", pattern->name);
+    printf("────────────────────────────────────────────────────────────────────────────\n");
+    printf("%-15s %8s %15s %10s %10s\n", "Allocator", "Threads", "Ops/sec", "Scaling", "Extra");
+
+    for (int a = 0; a < num_allocs; a++) {
+        double base = 0;
+        for (int c = 0; c < num_counts; c++) {
+            uint64_t failures = 0;
+            int threads = thread_counts[c];
+
+            openalloc_init(heap, HEAP_SIZE);
+            double ops_per_sec = pattern->run(allocs[a], threads, &failures);
+            if (c == 0) base = ops_per_sec;
+
+            char extra[32] = "";
+            if (pattern->run == pattern_false_sharing) {
+                snprintf(extra, sizeof(extra), "%.0f%% shared", last_shared_pct);
+            } else if (failures) {
+                snprintf(extra, sizeof(extra), "%lu fail", (unsigned long)failures);
+            }
+
+            printf("%-15s %8d %15.0f %9.2fx %10s\n",
+                   allocs[a]->name, threads, ops_per_sec, ops_per_sec / base, extra);
+            fflush(stdout);
+        }
+    }
+}
+
+// First CPU of a node from sysfs, or -1. Node 0 falls back to the current
+// CPU on kernels without the node directory.
+static int node_first_cpu(int node) {
+    char path[64];
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+    FILE* f = fopen(path, "r");
+    int cpu = -1;
+    if (f) {
+        if (fscanf(f, "%d", &cpu) != 1) cpu = -1;
+        fclose(f);
+    }
+    if (cpu < 0 && node == 0) cpu = sched_getcpu();
+    return cpu;
+}
+
+static int pin_to_cpu(int cpu) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return sched_setaffinity(0, sizeof(set), &set);
+}
+
+// Allocates from a NUMA heap pinned to one node, then sweeps the memory
+// pinned to each node in turn: the diagonal is local access, the rest
+// crosses sockets. Pinning uses sched_setaffinity, so numactl is not needed.
+static void benchmark_numa(void) {
+    printf("\nNUMA placement (%d x %d-byte blocks, read-modify-write sweeps)\n",
+           NUMA_BLOCKS, NUMA_BLOCK_SIZE);
+    printf("────────────────────────────────────────────────────────────────────────────\n");
+    
+    cpu_set_t saved;
+    sched_getaffinity(0, sizeof(saved), &saved);
+    
+    if (openalloc_init_growable(0) != 0 || openalloc_set_numa(1) != 0) {
+        printf("skipped (NUMA heaps unsupported)\n");
+        return;
+    }
+    openalloc_stats_t stats;
+    int nodes = 0;
+    while (openalloc_get_node_stats(nodes, &stats) == 0) nodes++;
+    
+    static uint64_t* blocks[NUMA_BLOCKS];
+    printf("%-12s %-12s %15s\n", "Alloc node", "Access node", "GB/s");
+    for (int from = 0; from < nodes; from++) {
+        int from_cpu = node_first_cpu(from);
+        if (from_cpu < 0 || pin_to_cpu(from_cpu) != 0) continue;
+        
+        for (int i = 0; i < NUMA_BLOCKS; i++) {
+            blocks[i] = openalloc_malloc(NUMA_BLOCK_SIZE);
+            memset(blocks[i], 0, NUMA_BLOCK_SIZE);
+        }
+        
+        for (int to = 0; to < nodes; to++) {
+            int to_cpu = node_first_cpu(to);
+            if (to_cpu < 0 || pin_to_cpu(to_cpu) != 0) continue;
+            
+            double start = get_time_seconds();
+            for (int pass = 0; pass < NUMA_PASSES; pass++) {
+                for (int i = 0; i < NUMA_BLOCKS; i++) {
+                    uint64_t* b = blocks[i];
+                    for (size_t w = 0; w < NUMA_BLOCK_SIZE / sizeof(uint64_t); w += 8) b[w]++;
+                }
+            }
+            double secs = get_time_seconds() - start;
+            printf("%-12d %-12d %15.2f%s\n", from, to,
+                   (double)NUMA_PASSES * NUMA_BLOCKS * NUMA_BLOCK_SIZE / secs / 1e9,
+                   from == to ? "  (local)" : "  (remote)");
+        }
+        
+        for (int i = 0; i < NUMA_BLOCKS; i++) openalloc_free(blocks[i]);
+    }
+    if (nodes == 1) printf("single node: no remote access to measure\n");
+    
+    for (int n = 0; n < nodes; n++) {
+        openalloc_get_node_stats(n, &stats);
+        printf("node %d heap: %zu bytes\n", n, stats.heap_size);
+    }
+    sched_setaffinity(0, sizeof(saved), &saved);
+}
+
+int main(int argc, char** argv) {
+    int max_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (argc > 1) {
+        max_threads = atoi(argv[1]);
+    }
+    if (max_threads < 1) max_threads = 1;
+    if (max_threads > MAX_THREADS) max_threads = MAX_THREADS;
+
+    int thread_counts[16];
+    int num_counts = 0;
+    for (int t = 1; t < max_threads; t *= 2) {
+        thread_counts[num_counts++] = t;
+    }
+    thread_counts[num_counts++] = max_threads;
+
+    printf("\n");
+    printf("╔════════════════════════════════════════════════════════════════════════════╗\n");
+    printf("║              OpenAlloc Multi-threaded Scalability Benchmark                ║\n");
+    printf("╚════════════════════════════════════════════════════════════════════════════╝\n");
+    printf("\nThreads: 1..%d (producer/consumer counts pairs)\n", max_threads);
+
+    static pthread_mutex_t openalloc_lock = PTHREAD_MUTEX_INITIALIZER;
+
+    allocator_t openalloc_alloc = {
+        .name = "OpenAlloc",
+        .malloc = openalloc_locked_malloc,
+        .free = openalloc_locked_free,
+        .ctx = &openalloc_lock
+    };
+
+    allocator_t glibc_alloc = {
+        .name = "glibc malloc",
+        .malloc = glibc_malloc,
+        .free = glibc_free,
+        .ctx = NULL
+    };
+
+    allocator_t* allocs[] = {&glibc_alloc, &openalloc_alloc};
+
+    pattern_t patterns[] = {
+        {"Thread-local churn (16-512B)", pattern_churn},
+        {"Producer/consumer cross-thread frees (16-256B)", pattern_producer_consumer},
+        {"Larson-style migration (8-512B)", pattern_larson},
+        {"False-sharing probe (16B, interleaved)", pattern_false_sharing},
+    };
+
+    for (size_t p = 0; p < sizeof(patterns) / sizeof(patterns[0]); p++) {
+        benchmark_pattern(&patterns[p], allocs, 2, thread_counts, num_counts);
+    }
+    benchmark_numa();
+    printf("═════════════════════════════════════════════════════════════════════════════\n");
+    printf("\n");
+
+    return 0;
+}
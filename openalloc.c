@@ -1,18 +1,57 @@
+#define _GNU_SOURCE
 #include "openalloc.h"
+#include "openalloc_inline.h"
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/random.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
 
-#define NUM_BINS 10
+#define NUM_BINS OPENALLOC_NUM_BINS
 
 #define LIKELY(x) __builtin_expect(!!(x), 1)
 #define UNLIKELY(x) __builtin_expect(!!(x), 0)
 
-#define BLOCK_HEADER_SIZE 16
+#define DEFAULT_SEGMENT_SIZE (64 * 1024 * 1024)
 
-typedef struct block_header {
-    size_t size;
-    struct block_header* next;
-    uint8_t free;
-} block_header_t;
+// Larger requests are refused before any size arithmetic, which adds
+// alignment, headers and segment rounding to them and must not wrap. No
+// object can be larger than PTRDIFF_MAX anyway.
+#define MAX_REQUEST (SIZE_MAX >> 1)
+
+// Bumped by every init, so state kept outside the heap that points into it
+// (the epoch limbo lists) can tell that the heap it points into is gone.
+static unsigned heap_generation = 0;
+
+// Background maintenance (openalloc_start_background): while its thread
+// runs, openalloc_background is set and each entry point holds
+// background_mutex, taken once by the outermost call.
+int openalloc_background = 0;
+static pthread_mutex_t background_mutex = PTHREAD_MUTEX_INITIALIZER;
+static __thread int heap_lock_held;
+
+static inline int heap_lock_needed(void) {
+    return UNLIKELY(openalloc_background) && !heap_lock_held;
+}
+
+static void heap_lock(void) {
+    pthread_mutex_lock(&background_mutex);
+    heap_lock_held = 1;
+}
+
+static void heap_unlock(void) {
+    heap_lock_held = 0;
+    pthread_mutex_unlock(&background_mutex);
+}
+
+typedef openalloc_block_t block_header_t;
 
 #ifdef OPENALLOC_NO_SEG
 
@@ -114,6 +153,7 @@ int openalloc_init(void* heap_ptr, size_t size) {
     
     heap_start = heap_ptr;
     heap_size = size;
+    heap_generation++;
     
     free_list = (block_header_doubly_t*)heap_start;
     free_list->size = size - sizeof(block_header_doubly_t);
@@ -125,7 +165,7 @@ int openalloc_init(void* heap_ptr, size_t size) {
 }
 
 void* openalloc_malloc(size_t size) {
-    if (size == 0) return NULL;
+    if (size == 0 || size > MAX_REQUEST) return NULL;
     
     size_t aligned_size = align_size(size);
     
@@ -154,6 +194,220 @@ void* openalloc_malloc(size_t size) {
     return NULL;
 }
 
+void* openalloc_memalign(size_t alignment, size_t size) {
+    if (alignment <= OPENALLOC_ALIGN) return openalloc_malloc(size);
+    if (alignment & (alignment - 1)) return NULL;
+    if (size == 0) return NULL;
+    
+    size_t lead_min = sizeof(block_header_doubly_t) + OPENALLOC_MIN_BLOCK;
+    if (alignment > MAX_REQUEST / 2 || size > MAX_REQUEST - alignment - lead_min) return NULL;
+    uint8_t* raw = openalloc_malloc(align_size(size) + alignment + lead_min);
+    if (!raw || ((uintptr_t)raw & (alignment - 1)) == 0) return raw;
+    
+    uint8_t* target = (uint8_t*)(((uintptr_t)raw + lead_min + alignment - 1) & ~(uintptr_t)(alignment - 1));
+    block_header_doubly_t* block = get_block_doubly(raw);
+    block_header_doubly_t* aligned_block = get_block_doubly(target);
+    
+    aligned_block->size = block->size - (size_t)(target - raw);
+    aligned_block->free = 0;
+    aligned_block->next = NULL;
+    aligned_block->prev = NULL;
+    block->size = (size_t)(target - raw) - sizeof(block_header_doubly_t);
+    openalloc_free(raw);
+    
+    return target;
+}
+
+int openalloc_init_growable(size_t segment_size) {
+    (void)segment_size;
+    return -1;
+}
+
+int openalloc_add_region(void* region, size_t size) {
+    (void)region;
+    (void)size;
+    return -1;
+}
+
+int openalloc_set_deferred_free(int enable) {
+    return enable ? -1 : 0;
+}
+
+void openalloc_flush(void) {
+}
+
+int openalloc_set_guard_sample_rate(size_t rate) {
+    return rate ? -1 : 0;
+}
+
+int openalloc_set_slab_max(size_t max_size) {
+    return max_size ? -1 : 0;
+}
+
+int openalloc_set_numa(int enable) {
+    return enable ? -1 : 0;
+}
+
+int openalloc_set_huge_pages(int enable) {
+    return enable ? -1 : 0;
+}
+
+int openalloc_reserve(size_t size, size_t count) {
+    (void)size;
+    (void)count;
+    return -1;
+}
+
+int openalloc_prefault(void) {
+    return -1;
+}
+
+void* openalloc_malloc_hint(size_t size, int hint) {
+    (void)hint;
+    return openalloc_malloc(size);
+}
+
+int openalloc_set_limits(size_t soft, size_t hard) {
+    return soft || hard ? -1 : 0;
+}
+
+void openalloc_set_pressure_callback(openalloc_pressure_fn fn, void* arg) {
+    (void)fn;
+    (void)arg;
+}
+
+size_t openalloc_in_use(void) {
+    return 0;
+}
+
+int openalloc_set_tag(int tag) {
+    return tag ? -1 : 0;
+}
+
+void* openalloc_malloc_tagged(size_t size, int tag) {
+    (void)tag;
+    return openalloc_malloc(size);
+}
+
+int openalloc_get_tag_stats(int tag, openalloc_tag_stats_t* stats) {
+    (void)tag;
+    (void)stats;
+    return -1;
+}
+
+int openalloc_init_persistent(void* base, size_t size) {
+    (void)base;
+    (void)size;
+    return -1;
+}
+
+int openalloc_attach(void* base, size_t size) {
+    (void)base;
+    (void)size;
+    return -1;
+}
+
+int openalloc_detach(void) {
+    return -1;
+}
+
+int openalloc_set_root(void* ptr) {
+    (void)ptr;
+    return -1;
+}
+
+void* openalloc_get_root(void) {
+    return NULL;
+}
+
+openalloc_handle_t openalloc_halloc(size_t size) {
+    (void)size;
+    return 0;
+}
+
+void* openalloc_hlock(openalloc_handle_t handle) {
+    (void)handle;
+    return NULL;
+}
+
+void openalloc_hunlock(openalloc_handle_t handle) {
+    (void)handle;
+}
+
+void openalloc_hfree(openalloc_handle_t handle) {
+    (void)handle;
+}
+
+int openalloc_compact(unsigned budget_us) {
+    (void)budget_us;
+    return 0;
+}
+
+int openalloc_start_background(unsigned interval_ms) {
+    (void)interval_ms;
+    return -1;
+}
+
+void openalloc_stop_background(void) {
+}
+
+int openalloc_get_stats_snapshot(openalloc_stats_t* stats) {
+    (void)stats;
+    return -1;
+}
+
+uint64_t openalloc_background_passes(void) {
+    return 0;
+}
+
+int openalloc_init_shared(void* base, size_t size) {
+    (void)base;
+    (void)size;
+    return -1;
+}
+
+int openalloc_attach_shared(void* base, size_t size) {
+    (void)base;
+    (void)size;
+    return -1;
+}
+
+size_t openalloc_ptr_to_offset(const void* ptr) {
+    (void)ptr;
+    return 0;
+}
+
+void* openalloc_offset_to_ptr(size_t offset) {
+    (void)offset;
+    return NULL;
+}
+
+int openalloc_check_heap(void) {
+    if (!heap_start) return 0;
+    
+    uint8_t* end = (uint8_t*)heap_start + heap_size;
+    size_t blocks = 0;
+    block_header_doubly_t* block = (block_header_doubly_t*)heap_start;
+    while ((uint8_t*)block < end) {
+        if ((uint8_t*)block + sizeof(block_header_doubly_t) + block->size > end) {
+            fprintf(stderr, "openalloc: check_heap: block %p runs past the heap\n", (void*)block);
+            return -1;
+        }
+        blocks++;
+        block = (block_header_doubly_t*)((uint8_t*)block + sizeof(block_header_doubly_t) + block->size);
+    }
+    
+    block_header_doubly_t* prev = NULL;
+    for (block = free_list; block; prev = block, block = block->next) {
+        if ((uint8_t*)block < (uint8_t*)heap_start || (uint8_t*)block >= end || blocks-- == 0 ||
+            !block->free || block->prev != prev) {
+            fprintf(stderr, "openalloc: check_heap: bad free list entry %p\n", (void*)block);
+            return -1;
+        }
+    }
+    return 0;
+}
+
 void openalloc_free(void* ptr) {
     if (!ptr) return;
     
@@ -172,134 +426,2416 @@ void openalloc_free(void* ptr) {
 
 #else
 
-static block_header_t* free_lists[NUM_BINS] __attribute__((aligned(64))) = {NULL};
+typedef struct region {
+    struct region* next;
+    size_t size;
+    size_t mapped;
+    size_t node;
+} region_t;
+
+// Exported for the inline fast path in openalloc_inline.h.
+block_header_t* openalloc_free_lists[NUM_BINS] __attribute__((aligned(64))) = {NULL};
 static void* heap_start = NULL;
 static size_t heap_size = 0;
+static block_header_t* first_block = NULL;
+
+// The top: the free block at the end of the newest region, which the heap
+// has not carved into yet. It stays out of the bins and has no footer;
+// malloc bumps blocks off its front when the bins miss, and a block freed
+// right in front of it merges back into it.
+static block_header_t* top = NULL;
+
+// Regions added after init (growth segments or openalloc_add_region).
+// Each one starts with its region_t; blocks follow it.
+static region_t* regions = NULL;
+static size_t segment_size = 0;
+static int primary_mapped = 0;
+
+// Heap limits (openalloc_set_limits). openalloc_used is the live bytes as
+// openalloc_usable_size reports them, counted by the public entry points;
+// what the allocator takes for itself (slabs, lifetime chunks) is not. A
+// malloc that would take it past openalloc_limit_low, the soft limit or
+// else the hard one, goes through admit(). Both are exported for the
+// inline fast path.
+size_t openalloc_used = 0;
+size_t openalloc_limit_low = SIZE_MAX;
+static size_t limit_soft = 0;
+static size_t limit_hard = 0;
+static openalloc_pressure_fn pressure_fn = NULL;
+static void* pressure_arg = NULL;
+static int in_pressure = 0;
+
+// Deferred free mode: frees are queued here and returned to the bins by
+// openalloc_flush() as one pre-built chain per bin.
+#define DEFER_CAPACITY 256
+#define DEFER_PREFETCH 8
+static block_header_t* deferred[DEFER_CAPACITY];
+static int deferred_count = 0;
+static int deferred_enabled = 0;
+
+// Guard-page sampling: sampled allocations live in a pool of one-page slots
+// separated by PROT_NONE pages. A slot is opened (made writable) for one
+// allocation and closed again on free; free slots are reused in FIFO
+// order, so a freed object stays inaccessible for the next GUARD_SLOTS - 1
+// sampled allocations. The rate is exported for the inline fast path,
+// which leaves a sampled heap to openalloc_malloc.
+#define GUARD_SLOTS 256
+static uint8_t* guard_pool = NULL;
+static uint16_t guard_fifo[GUARD_SLOTS];
+static int guard_fifo_head = 0;
+static int guard_fifo_count = 0;
+size_t openalloc_guard_rate = 0;
+static size_t guard_countdown = 0;
+static uint64_t guard_rng = 0x9e3779b97f4a7c15ULL;
+static size_t page_size = 0;
+
+// Small-object slabs: SLAB_SIZE-aligned chunks of the heap holding
+// header-free objects of one size class. The page map below is keyed by
+// address >> SLAB_SHIFT and holds slab | node | bin for every live slab and
+// node for every NUMA segment chunk, so free and usable_size find an
+// object's class and owning heap without reading memory next to it.
+#define SLAB_SHIFT 14
+#define SLAB_SIZE ((size_t)1 << SLAB_SHIFT)
+#define PAGEMAP_LEAF_BITS 18
+#define PAGEMAP_ROOT_BITS (48 - SLAB_SHIFT - PAGEMAP_LEAF_BITS)
+#define PAGEMAP_BIN_MASK ((uintptr_t)0x7f)
+#define PAGEMAP_NODE_SHIFT 7
+#define PAGEMAP_SLAB_MASK (~(uintptr_t)(SLAB_SIZE - 1))
+#define PAGEMAP_NODE(entry) ((int)(((entry) >> PAGEMAP_NODE_SHIFT) & (MAX_NODES - 1)))
+
+typedef struct slab_obj {
+    struct slab_obj* next;
+} slab_obj_t;
+
+typedef struct slab {
+    struct slab* next;      // slabs of this bin with room, most recent first
+    struct slab* prev;
+    slab_obj_t* free;       // freed objects, linked through their first word
+    uint8_t* bump;          // first never-used object
+    uint8_t* end;
+    size_t used;
+    size_t obj_size;
+    int bin;
+    int node;
+    int in_arena;
+} slab_t;
+
+// Huge-page arena the running node carves slabs from, and its empty slabs.
+typedef struct slab_arena {
+    uint8_t* next;
+    uint8_t* end;
+    slab_t* spare;
+} slab_arena_t;
+
+static uintptr_t* pagemap_root[(size_t)1 << PAGEMAP_ROOT_BITS];
+static slab_t* slab_lists[NUM_BINS];
+static slab_arena_t slab_arena;
+static size_t slab_max = 0;
+static size_t slabs_live = 0;
+
+// NUMA heaps: with openalloc_set_numa(1) every node has its own bins and
+// slab lists and grows from segments placed on that node. malloc serves
+// the running thread's node (getcpu); that node's lists live in
+// openalloc_free_lists and slab_lists, where the inline fast path expects
+// them, and the other nodes' in node_heaps. free returns a block to the
+// node that owns its segment, which the page map records.
+#define MAX_NODES 64
+#define MPOL_PREFERRED 1    // from linux/mempolicy.h
+
+typedef struct node_heap {
+    block_header_t* bins[NUM_BINS];
+    block_header_t* top;
+    slab_t* slabs[NUM_BINS];
+    slab_arena_t arena;
+} node_heap_t;
+
+static node_heap_t node_heaps[MAX_NODES];
+static int numa_nodes = 0;
+static int active_node = 0;
+
+// Set while there is more than one node to choose between; the inline fast
+// path cannot call select_node and leaves those heaps to openalloc_malloc.
+int openalloc_numa_enabled = 0;
+
+// Lifetime heaps for openalloc_malloc_hint. Short-lived blocks are bumped
+// out of LIFETIME_CHUNK-sized chunks of the main heap; a chunk is recycled
+// whole once its last block is freed, so churn leaves no holes behind. Its
+// page map entries hold its address with PAGEMAP_BUMP in the bin bits, the
+// way a slab's do. Long-lived and permanent blocks get bins and a top of
+// their own in node_heaps[hint - 1], which go unused without NUMA. Those
+// grow by chunks of the main heap laid out as regions whose page map
+// entries carry that index as their node, so free returns blocks to them
+// as it does for NUMA nodes.
+#define LIFETIME_CHUNK ((size_t)64 << 10)
+#define NUM_LIFETIMES 2
+#define PAGEMAP_BUMP PAGEMAP_BIN_MASK
+
+typedef struct bump_chunk {
+    uint8_t* bump;      // fence after the last block
+    uint8_t* end;
+    size_t live;
+} bump_chunk_t;
+
+static bump_chunk_t* bump_current = NULL;
+static bump_chunk_t* bump_spare = NULL;
+static int lifetime_heaps = 0;
+
+// Allocation tags. Tag t has a heap of its own in node_heaps[TAG_NODE(t)],
+// after the lifetime heaps, grown by chunks the way theirs are, so the page
+// map tells free which tag a block belongs to and no block carries it.
+// openalloc_tagging counts the threads with a tag set; while it is 0
+// malloc does not look at current_tag.
+#define TAG_NODE(tag) (1 + NUM_LIFETIMES + (tag) - 1)
+#define NODE_TAG(node) ((node) - NUM_LIFETIMES)
+#define TAG_NODES (1 + NUM_LIFETIMES + OPENALLOC_MAX_TAGS - 1)
+_Static_assert(TAG_NODES <= MAX_NODES, "too many tags for the page map's node bits");
+int openalloc_tagging = 0;
+static __thread int current_tag;
+static openalloc_tag_stats_t tag_stats[OPENALLOC_MAX_TAGS];
+
+// Huge pages: new segments are HUGE_PAGE_SIZE-aligned and either hugetlbfs
+// backed or advised MADV_HUGEPAGE, and slabs are packed into huge-page
+// arenas so the hot small classes share a few TLB entries.
+#define HUGE_PAGE_SIZE ((size_t)2 << 20)
+static int huge_pages = 0;
+
+// Set by openalloc_prefault: segments the heap grows by afterwards are
+// populated as they are mapped.
+static int prefault_segments = 0;
+
+// Persistent heap: the heap is a caller-mapped file that starts with this
+// header. Free-list links are offsets from the mapping (openalloc_link_base),
+// so a later openalloc_attach can map the file anywhere. clean is set only
+// by openalloc_detach; an attach that finds it clear rebuilds the bins from
+// a walk of the blocks instead of trusting the saved ones.
+#define PERSIST_MAGIC 0x313050414548414fULL    // "OAHEAP01"
+#define PERSIST_HEADER_SIZE ((size_t)4096)
+#define PERSIST_MAX_BINS 128
+#define PERSIST_LAYOUT ((uint64_t)HEADER_SIZE | (uint64_t)OPENALLOC_ALIGN << 8 | PERSIST_FLAGS << 16)
+#ifdef OPENALLOC_SAFE_LINKING
+#define PERSIST_FLAGS ((uint64_t)1)
+#else
+#define PERSIST_FLAGS ((uint64_t)0)
+#endif
+
+typedef struct persist_header {
+    uint64_t magic;
+    uint64_t layout;        // block layout and link encoding of the writer
+    uint64_t size;
+    uint64_t classes;       // checksum of the size-class table
+    uint64_t clean;
+    uint64_t root;          // offset of the root object, 0 for none
+    uint64_t secret;
+    uint64_t first_block;
+    uint64_t bins[PERSIST_MAX_BINS];
+    uint32_t shared;        // set by openalloc_init_shared
+    uint32_t lock;          // futex: 0 free, 1 held, 2 held with waiters
+    uint64_t bin_epoch;     // footer mark of binned free blocks
+    uint64_t top;           // offset of the top block, 0 for none
+} persist_header_t;
+
+_Static_assert(sizeof(persist_header_t) <= PERSIST_HEADER_SIZE, "persist header too large");
+_Static_assert(NUM_BINS <= PERSIST_MAX_BINS, "too many bins for the persist header");
+
+uintptr_t openalloc_link_base = 0;
+static persist_header_t* persist = NULL;
+
+// Shared heap: a persistent heap mapped by several processes at once. Its
+// bins live in the file header; an operation takes the header lock, loads
+// them into openalloc_free_lists, and stores and clears them again before
+// unlocking, so the inline fast path finds empty bins and takes the locked
+// path. shared_unlocked is set while this process is attached and not
+// inside an operation.
+static int shared_unlocked = 0;
+
+// Movable blocks: openalloc_halloc hands out an index into this table
+// instead of an address, and the block's first payload word holds the
+// index, so compaction can tell which blocks it may move and whose entry
+// to update. A block is pinned while its lock count is nonzero.
+typedef struct handle_slot {
+    block_header_t* block;      // NULL while the slot is free
+    uint32_t locks;
+    uint32_t next_free;         // handle of the next free slot
+} handle_slot_t;
+
+#define HANDLE_WORD sizeof(size_t)
+static handle_slot_t* handles = NULL;
+static size_t handle_cap = 0;
+static uint32_t handle_top = 0;     // slots ever handed out
+static uint32_t handle_free = 0;    // handle of the first free slot, 0 if none
+
+// Compaction runs in passes over the regions, a bounded step per
+// openalloc_compact call. A pass starts by emptying the bins and flipping
+// bin_epoch, the low bit of every free block's footer from then on: a free
+// block whose footer has the old value is one the pass has not reached and
+// is in no bin, so the pass may merge it or slide a block into it without
+// unlinking it from a singly linked bin. Blocks freed during the pass carry
+// the new value and are left where they are.
+static size_t bin_epoch = 0;
+static block_header_t* compact_cursor = NULL;   // NULL between passes
+static region_t* compact_next_region = NULL;
+
+// A pass counts the blocks it steps over; a finished pass publishes the
+// totals as the stats snapshot.
+static openalloc_stats_t pass_stats;
+static openalloc_stats_t stats_snapshot;
+static int snapshot_valid = 0;
+
+static void clear_pagemap(void);
+static void compact_run(uint64_t deadline, int move);
+static void* aligned_malloc(size_t alignment, size_t size);
+static void* tagged_malloc(size_t size, int tag);
+
+#define HEADER_SIZE OPENALLOC_HEADER_SIZE
+#define FENCE_SIZE OPENALLOC_HEADER_SIZE
+#define BLOCK_ALLOC OPENALLOC_BLOCK_ALLOC
+#define BLOCK_PREV_ALLOC OPENALLOC_BLOCK_PREV_ALLOC
+#define BLOCK_GUARDED OPENALLOC_BLOCK_GUARDED
+#define SIZE_MASK (~OPENALLOC_BLOCK_FLAGS)
+
+#if defined(OPENALLOC_DEBUG) || defined(OPENALLOC_SAFE_LINKING)
+static void heap_fail(const char* what, const void* ptr) {
+    fprintf(stderr, "openalloc: %s (%p)\n", what, ptr);
+    abort();
+}
+#endif
+
+// Debug builds check headers, canaries and free-list links as they go and
+// abort on the first inconsistency. Release builds compile the checks out.
+#ifdef OPENALLOC_DEBUG
+#define CANARY(block) ((uintptr_t)0x6f70656e616c6c63ULL ^ ((uintptr_t)(block) - openalloc_link_base))
+#define DEBUG_CHECK(cond, what, ptr) \
+    do { if (UNLIKELY(!(cond))) heap_fail(what, ptr); } while (0)
+#else
+#define DEBUG_CHECK(cond, what, ptr) ((void)0)
+#endif
+
+#ifdef OPENALLOC_SAFE_LINKING
+// Per-heap secret mixed into every in-block free-list link; see
+// OPENALLOC_PROTECT in openalloc_inline.h.
+uintptr_t openalloc_link_secret = 0;
+
+static uintptr_t new_link_secret(void) {
+    uintptr_t secret;
+    if (getrandom(&secret, sizeof(secret), GRND_NONBLOCK) == (ssize_t)sizeof(secret)) return secret;
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uintptr_t)ts.tv_nsec << 32) ^ (uintptr_t)ts.tv_sec ^ (uintptr_t)&secret;
+}
+#endif
 
 static inline size_t align_size(size_t size) {
-    return (size + OPENALLOC_ALIGN - 1) & ~(OPENALLOC_ALIGN - 1);
+    size = (size + OPENALLOC_ALIGN - 1) & ~(OPENALLOC_ALIGN - 1);
+    return size < OPENALLOC_MIN_BLOCK ? OPENALLOC_MIN_BLOCK : size;
 }
 
 static inline int get_bin(size_t size) {
-    if (LIKELY(size <= 16)) return 0;
-    if (LIKELY(size <= 32)) return 1;
-    if (LIKELY(size <= 64)) return 2;
-    if (LIKELY(size <= 128)) return 3;
-    if (LIKELY(size <= 256)) return 4;
-    if (LIKELY(size <= 512)) return 5;
-    if (LIKELY(size <= 1024)) return 6;
-    if (LIKELY(size <= 2048)) return 7;
-    if (LIKELY(size <= 4096)) return 8;
-    return 9;
+    return openalloc_size_class(size);
+}
+
+// Free-list links inside blocks go through these two. Bin heads live
+// outside the heap and are stored in the clear.
+static inline block_header_t* reveal_next(const block_header_t* block) {
+    return OPENALLOC_REVEAL(&block->next, block->next);
+}
+
+static inline block_header_t* get_next(const block_header_t* block) {
+    block_header_t* next = reveal_next(block);
+#ifdef OPENALLOC_SAFE_LINKING
+    if (UNLIKELY(!OPENALLOC_LINK_OK(next))) heap_fail("corrupted free list link", block);
+#endif
+    return next;
+}
+
+static inline void set_next(block_header_t* block, block_header_t* next) {
+    block->next = OPENALLOC_PROTECT(&block->next, next);
 }
 
 static inline block_header_t* get_block(void* ptr) {
-    return (block_header_t*)((uint8_t*)ptr - sizeof(block_header_t));
+    return (block_header_t*)((uint8_t*)ptr - HEADER_SIZE);
 }
 
 static inline void* get_data(block_header_t* block) {
-    return (uint8_t*)block + sizeof(block_header_t);
+    return (uint8_t*)block + HEADER_SIZE;
 }
 
-int openalloc_init(void* heap_ptr, size_t size) {
-    if (!heap_ptr || size < OPENALLOC_MIN_BLOCK + sizeof(block_header_t)) {
-        return -1;
-    }
-    
-    heap_start = heap_ptr;
-    heap_size = size;
-    
-    for (int i = 0; i < NUM_BINS; i++) {
-        free_lists[i] = NULL;
+static inline size_t block_size(const block_header_t* block) {
+    return block->header & SIZE_MASK;
+}
+
+static inline block_header_t* next_block(block_header_t* block) {
+    return (block_header_t*)((uint8_t*)block + HEADER_SIZE + block_size(block));
+}
+
+static inline void init_block(block_header_t* block, size_t header) {
+#ifdef OPENALLOC_DEBUG
+    block->canary = CANARY(block);
+#endif
+    block->header = header;
+}
+
+static inline int canary_ok(const block_header_t* block) {
+#ifdef OPENALLOC_DEBUG
+    return block->canary == CANARY(block);
+#else
+    (void)block;
+    return 1;
+#endif
+}
+
+static int heap_contains(const void* ptr) {
+    const uint8_t* p = ptr;
+    if (p >= (uint8_t*)first_block && p < (uint8_t*)heap_start + heap_size) return 1;
+    for (region_t* region = regions; region; region = region->next) {
+        if (p >= (uint8_t*)(region + 1) && p < (uint8_t*)region + region->size) return 1;
     }
-    
-    block_header_t* block = (block_header_t*)heap_start;
-    block->size = size - sizeof(block_header_t);
-    block->free = 1;
-    block->next = NULL;
-    free_lists[NUM_BINS - 1] = block;
-    
     return 0;
 }
 
-void* openalloc_malloc(size_t size) {
-    if (UNLIKELY(size == 0)) return NULL;
-    
-    size_t aligned_size = align_size(size);
-    int start_bin = get_bin(aligned_size);
+static inline int valid_block(const block_header_t* block) {
+    return ((uintptr_t)block & (OPENALLOC_ALIGN - 1)) == 0 && heap_contains(block) && canary_ok(block);
+}
+
+// Lays out [free block][fence] over len bytes at start. The fence is a
+// zero-size allocated header, so next_block() never leaves the region.
+static block_header_t* format_region(uint8_t* start, size_t len) {
+    block_header_t* block = (block_header_t*)start;
+    block_header_t* fence = (block_header_t*)(start + len - FENCE_SIZE);
+    init_block(block, (len - HEADER_SIZE - FENCE_SIZE) | BLOCK_PREV_ALLOC);
+    init_block(fence, BLOCK_ALLOC);
+    ((size_t*)fence)[-1] = block_size(block) | bin_epoch;
+    return block;
+}
+
+// Marks block free: the last payload word holds the size as a footer and
+// the next block's PREV_ALLOC bit is cleared. Returns the block's bin.
+static inline int release_block(block_header_t* block) {
+    size_t size = block_size(block);
+    block_header_t* next = next_block(block);
     
-    for (int bin = start_bin; bin < NUM_BINS; bin++) {
-        block_header_t** prev = &free_lists[bin];
-        block_header_t* block = *prev;
-        
-        while (LIKELY(block != NULL)) {
-            if (LIKELY(block->free) && LIKELY(block->size >= aligned_size)) {
-                block_header_t* original_next = block->next;
-                
-                if (LIKELY(block->size >= aligned_size + OPENALLOC_MIN_BLOCK + sizeof(block_header_t))) {
-                    block_header_t* new_block = (block_header_t*)((uint8_t*)block + sizeof(block_header_t) + aligned_size);
-                    new_block->size = block->size - aligned_size - sizeof(block_header_t);
-                    new_block->free = 1;
-                    new_block->next = original_next;
-                    
-                    block->size = aligned_size;
-                    
-                    int new_bin = get_bin(new_block->size);
-                    
-                    if (LIKELY(new_bin == bin)) {
-                        new_block->next = block->next;
-                        *prev = new_block;
-                        prev = &new_block->next;
-                    } else {
-                        new_block->next = free_lists[new_bin];
-                        free_lists[new_bin] = new_block;
-                    }
-                }
-                
-                block->free = 0;
-                *prev = original_next;
-                block->next = NULL;
-                
-                return get_data(block);
-            }
-            prev = &block->next;
-            block = block->next;
-        }
+    block->header &= ~BLOCK_ALLOC;
+    ((size_t*)next)[-1] = size | bin_epoch;
+    next->header &= ~BLOCK_PREV_ALLOC;
+    return get_bin(size);
+}
+
+static inline void bin_block(block_header_t* block) {
+    int bin = release_block(block);
+    set_next(block, openalloc_free_lists[bin]);
+    openalloc_free_lists[bin] = block;
+}
+
+// Folds block, which ends where *top_ptr starts, into that top.
+static inline void merge_top(block_header_t* block, block_header_t** top_ptr) {
+    block->header = (block_size(block) + HEADER_SIZE + block_size(*top_ptr)) | (block->header & BLOCK_PREV_ALLOC);
+    if (UNLIKELY(compact_cursor == *top_ptr)) compact_cursor = block;
+    *top_ptr = block;
+}
+
+static inline void push_free(block_header_t* block) {
+    if (UNLIKELY(next_block(block) == top)) {
+        merge_top(block, &top);
+        return;
     }
-    
-    return NULL;
+    bin_block(block);
 }
 
-void openalloc_free(void* ptr) {
-    if (UNLIKELY(!ptr)) return;
-    
-    block_header_t* block = get_block(ptr);
-    block->free = 1;
-    
-    int bin = get_bin(block->size);
-    block->next = free_lists[bin];
-    free_lists[bin] = block;
+// Hands a top to its bins, footer and all, once a newer region takes over.
+static void bin_top(block_header_t** bins, block_header_t** top_ptr) {
+    block_header_t* block = *top_ptr;
+    if (!block) return;
+    *top_ptr = NULL;
+    ((size_t*)next_block(block))[-1] = block_size(block) | bin_epoch;
+    int bin = get_bin(block_size(block));
+    set_next(block, bins[bin]);
+    bins[bin] = block;
 }
 
-#endif
+static inline block_header_t** node_bins(int node) {
+    return node == active_node ? openalloc_free_lists : node_heaps[node].bins;
+}
 
-void* openalloc_realloc(void* ptr, size_t new_size) {
-    if (!ptr) return openalloc_malloc(new_size);
-    if (new_size == 0) {
-        openalloc_free(ptr);
-        return NULL;
+static inline block_header_t** node_top(int node) {
+    return node == active_node ? &top : &node_heaps[node].top;
+}
+
+static inline void push_free_node(block_header_t* block, int node) {
+    block_header_t** top_ptr = node_top(node);
+    if (next_block(block) == *top_ptr) {
+        merge_top(block, top_ptr);
+        return;
+    }
+    block_header_t** bins = node_bins(node);
+    int bin = release_block(block);
+    set_next(block, bins[bin]);
+    bins[bin] = block;
+}
+
+static void release_segments(void) {
+    region_t* region = regions;
+    while (region) {
+        region_t* next = region->next;
+        if (region->mapped) munmap(region, region->size);
+        region = next;
     }
+    if (primary_mapped) munmap(heap_start, heap_size);
+    regions = NULL;
+    primary_mapped = 0;
+}
+
+static void* map_segment(size_t size) {
+    void* mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    return mem == MAP_FAILED ? NULL : mem;
+}
+
+static uintptr_t* pagemap_slot(const void* ptr, int create);
+static block_header_t* add_region_node(void* region_ptr, size_t size, int node);
+
+// Places a SLAB_SIZE-aligned segment on node and marks every chunk of it as
+// that node's in the page map. The policy is preferred rather than bind,
+// so a full node spills over instead of faulting with SIGBUS; on a kernel
+// without NUMA support mbind fails and the memory is just unplaced.
+static int place_on_node(uint8_t* start, size_t size, int node) {
+    unsigned long nodemask = 1UL << node;
+    syscall(SYS_mbind, start, size, MPOL_PREFERRED, &nodemask, (unsigned long)MAX_NODES + 1, 0);
     
-#ifdef OPENALLOC_NO_SEG
-    block_header_doubly_t* block = get_block_doubly(ptr);
-    size_t old_size = block->size;
-#else
-    block_header_t* block = get_block(ptr);
-    size_t old_size = block->size;
+    for (uint8_t* p = start; p < start + size; p += SLAB_SIZE) {
+        uintptr_t* slot = pagemap_slot(p, 1);
+        if (!slot) return 0;
+        *slot = (uintptr_t)node << PAGEMAP_NODE_SHIFT;
+    }
+    return 1;
+}
+
+static void advise_huge_pages(void* mem, size_t size) {
+    uintptr_t start = ((uintptr_t)mem + HUGE_PAGE_SIZE - 1) & ~(uintptr_t)(HUGE_PAGE_SIZE - 1);
+    uintptr_t end = ((uintptr_t)mem + size) & ~(uintptr_t)(HUGE_PAGE_SIZE - 1);
+    if (end > start) madvise((void*)start, end - start, MADV_HUGEPAGE);
+}
+
+#ifndef MADV_POPULATE_WRITE
+#define MADV_POPULATE_WRITE 23    // from linux/mman.h, Linux 5.14
 #endif
+
+// Write-faults every page of [mem, mem + size) without changing its
+// contents. Kernels without MADV_POPULATE_WRITE get an atomic add of zero
+// per page, which cannot lose a store another thread makes to a live block
+// on the same page.
+static void prefault_range(void* mem, size_t size) {
+    uintptr_t start = (uintptr_t)mem & ~(uintptr_t)(page_size - 1);
+    uintptr_t end = (uintptr_t)mem + size;
+    if (madvise((void*)start, end - start, MADV_POPULATE_WRITE) == 0) return;
     
-    if (new_size <= old_size) {
-        return ptr;
+    uintptr_t p = ((uintptr_t)mem + sizeof(size_t) - 1) & ~(uintptr_t)(sizeof(size_t) - 1);
+    for (; p + sizeof(size_t) <= end; p = (p & ~(uintptr_t)(page_size - 1)) + page_size) {
+        __atomic_fetch_add((size_t*)p, 0, __ATOMIC_RELAXED);
+    }
+}
+
+// An align-aligned segment; size must be a multiple of align. With huge
+// pages on, hugetlbfs pages are tried first, then transparent huge pages.
+static void* map_aligned_segment(size_t size, size_t align) {
+    // No MAP_NORESERVE here: unreserved hugetlb pages fault with SIGBUS
+    // when the pool runs dry, whereas a reserving mmap fails up front.
+    if (huge_pages) {
+        void* mem = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (mem != MAP_FAILED) return mem;
+    }
+    
+    uint8_t* mem = map_segment(size + align);
+    if (!mem) return NULL;
+    
+    uint8_t* start = (uint8_t*)(((uintptr_t)mem + align - 1) & ~(uintptr_t)(align - 1));
+    if (start > mem) munmap(mem, start - mem);
+    if (start < mem + align) munmap(start + size, mem + align - start);
+    if (huge_pages) advise_huge_pages(start, size);
+    return start;
+}
+
+static void reset_guard_pool(void) {
+    mprotect(guard_pool, (2 * GUARD_SLOTS + 1) * page_size, PROT_NONE);
+    for (int i = 0; i < GUARD_SLOTS; i++) {
+        guard_fifo[i] = (uint16_t)i;
+    }
+    guard_fifo_head = 0;
+    guard_fifo_count = GUARD_SLOTS;
+}
+
+static int grow_heap(size_t aligned_size) {
+    if (aligned_size > MAX_REQUEST) return 0;
+    size_t overhead = sizeof(region_t) + HEADER_SIZE + FENCE_SIZE + OPENALLOC_ALIGN;
+    size_t size = segment_size;
+    if (aligned_size + overhead > size) {
+        size = (aligned_size + overhead + segment_size - 1) / segment_size * segment_size;
+    }
+    
+    void* mem;
+    size_t align = huge_pages ? HUGE_PAGE_SIZE : numa_nodes ? SLAB_SIZE : 0;
+    if (align) {
+        size = (size + align - 1) & ~(align - 1);
+        mem = map_aligned_segment(size, align);
+    } else {
+        mem = map_segment(size);
+    }
+    if (mem && numa_nodes && !place_on_node(mem, size, active_node)) {
+        munmap(mem, size);
+        mem = NULL;
+    }
+    block_header_t* block = mem ? add_region_node(mem, size, numa_nodes ? active_node : 0) : NULL;
+    if (!block) return 0;
+    regions->mapped = 1;
+    if (prefault_segments) prefault_range(mem, size);
+    
+    // The new segment becomes the top; what is left of the old one is
+    // too small for this request and goes to the bins.
+    bin_top(openalloc_free_lists, &top);
+    top = block;
+    return 1;
+}
+
+// Drops every mode and list and makes [heap_ptr, heap_ptr + size) the
+// primary region, with no blocks in it yet.
+static void reset_heap(void* heap_ptr, size_t size, uintptr_t link_base) {
+    openalloc_stop_background();
+    heap_generation++;
+    snapshot_valid = 0;
+    if (slabs_live || numa_nodes || lifetime_heaps) clear_pagemap();
+    slab_max = 0;
+    memset(&slab_arena, 0, sizeof(slab_arena));
+    huge_pages = 0;
+    prefault_segments = 0;
+    numa_nodes = 0;
+    openalloc_numa_enabled = 0;
+    active_node = 0;
+    lifetime_heaps = 0;
+    memset(tag_stats, 0, sizeof(tag_stats));
+    bump_current = NULL;
+    bump_spare = NULL;
+    memset(node_heaps, 0, sizeof(node_heaps));
+    release_segments();
+    segment_size = 0;
+    deferred_count = 0;
+    deferred_enabled = 0;
+    openalloc_guard_rate = 0;
+    guard_countdown = 0;
+    if (guard_pool) reset_guard_pool();
+    heap_start = heap_ptr;
+    heap_size = size;
+    first_block = NULL;
+    top = NULL;
+    openalloc_link_base = link_base;
+    persist = NULL;
+    shared_unlocked = 0;
+    if (handles) munmap(handles, handle_cap * sizeof(handle_slot_t));
+    handles = NULL;
+    handle_cap = 0;
+    handle_top = 0;
+    handle_free = 0;
+    bin_epoch = 0;
+    compact_cursor = NULL;
+    openalloc_used = 0;
+    openalloc_limit_low = SIZE_MAX;
+    limit_soft = 0;
+    limit_hard = 0;
+    pressure_fn = NULL;
+    pressure_arg = NULL;
+    
+    for (int i = 0; i < NUM_BINS; i++) {
+        openalloc_free_lists[i] = NULL;
+    }
+}
+
+int openalloc_init(void* heap_ptr, size_t size) {
+    uintptr_t start = ((uintptr_t)heap_ptr + OPENALLOC_ALIGN - 1) & ~(uintptr_t)(OPENALLOC_ALIGN - 1);
+    size_t skew = start - (uintptr_t)heap_ptr;
+    if (!heap_ptr || size < skew + HEADER_SIZE + OPENALLOC_MIN_BLOCK + FENCE_SIZE) {
+        return -1;
+    }
+    
+    reset_heap(heap_ptr, size, 0);
+#ifdef OPENALLOC_SAFE_LINKING
+    openalloc_link_secret = new_link_secret();
+#endif
+    
+    first_block = format_region((uint8_t*)start, (size - skew) & SIZE_MASK);
+    top = first_block;
+    
+    return 0;
+}
+
+int openalloc_init_growable(size_t seg_size) {
+    if (seg_size == 0) seg_size = DEFAULT_SEGMENT_SIZE;
+    seg_size = (seg_size + 4095) & ~(size_t)4095;
+    
+    void* mem = map_segment(seg_size);
+    if (!mem) return -1;
+    
+    openalloc_init(mem, seg_size);
+    segment_size = seg_size;
+    primary_mapped = 1;
+    return 0;
+}
+
+// Links in a region and returns its one free block, which the caller
+// bins or makes the top. NULL if the region is too small.
+static block_header_t* add_region_node(void* region_ptr, size_t size, int node) {
+    if (!region_ptr || !heap_start) return NULL;
+    
+    uintptr_t start = ((uintptr_t)region_ptr + OPENALLOC_ALIGN - 1) & ~(uintptr_t)(OPENALLOC_ALIGN - 1);
+    size_t skew = start - (uintptr_t)region_ptr;
+    if (size < skew + sizeof(region_t) + HEADER_SIZE + OPENALLOC_MIN_BLOCK + FENCE_SIZE) {
+        return NULL;
+    }
+    
+    region_t* region = (region_t*)start;
+    region->size = (size - skew) & SIZE_MASK;
+    region->mapped = 0;
+    region->node = (size_t)node;
+    region->next = regions;
+    regions = region;
+    
+    return format_region((uint8_t*)(region + 1), region->size - sizeof(region_t));
+}
+
+int openalloc_add_region(void* region_ptr, size_t size) {
+    if (heap_lock_needed()) {
+        heap_lock();
+        int ret = openalloc_add_region(region_ptr, size);
+        heap_unlock();
+        return ret;
+    }
+    if (persist) return -1;
+    block_header_t* block = add_region_node(region_ptr, size, 0);
+    if (!block) return -1;
+    push_free_node(block, 0);
+    return 0;
+}
+
+// FNV-1a over the size-class table, so a heap file written by a build with
+// different classes has its bins rebuilt rather than reused.
+static uint64_t class_checksum(void) {
+    uint64_t hash = 0xcbf29ce484222325ULL ^ NUM_BINS;
+    for (int i = 0; i < NUM_BINS - 1; i++) {
+        hash = (hash ^ openalloc_class_sizes[i]) * 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+int openalloc_init_persistent(void* base, size_t size) {
+    if (!base || ((uintptr_t)base & (OPENALLOC_ALIGN - 1)) ||
+        size < PERSIST_HEADER_SIZE + HEADER_SIZE + OPENALLOC_MIN_BLOCK + FENCE_SIZE) {
+        return -1;
+    }
+    
+    reset_heap(base, size, (uintptr_t)base);
+#ifdef OPENALLOC_SAFE_LINKING
+    openalloc_link_secret = new_link_secret();
+#endif
+    
+    first_block = format_region((uint8_t*)base + PERSIST_HEADER_SIZE, (size - PERSIST_HEADER_SIZE) & SIZE_MASK);
+    top = first_block;
+    
+    persist = base;
+    memset(persist, 0, sizeof(*persist));
+    persist->magic = PERSIST_MAGIC;
+    persist->layout = PERSIST_LAYOUT;
+    persist->size = size;
+    persist->classes = class_checksum();
+    persist->first_block = PERSIST_HEADER_SIZE;
+#ifdef OPENALLOC_SAFE_LINKING
+    persist->secret = openalloc_link_secret;
+#endif
+    return 0;
+}
+
+// Refills the bins from a walk of the blocks after an unclean shutdown,
+// rewriting footers and PREV_ALLOC bits on the way. Blocks that were live
+// or queued for a deferred free stay allocated; a free block against the
+// fence becomes the top again.
+static int rebuild_bins(void) {
+    uint8_t* end = (uint8_t*)heap_start + heap_size;
+    block_header_t* block = first_block;
+    size_t prev_alloc = BLOCK_PREV_ALLOC;
+    
+    for (;;) {
+        if ((uint8_t*)block + HEADER_SIZE > end || !canary_ok(block)) return -1;
+        block->header = (block->header & ~BLOCK_PREV_ALLOC) | prev_alloc;
+        size_t size = block_size(block);
+        if (size == 0) return block->header & BLOCK_ALLOC ? 0 : -1;
+        if (size > (size_t)(end - (uint8_t*)block) - 2 * HEADER_SIZE) return -1;
+        
+        if (block->header & BLOCK_ALLOC) {
+            prev_alloc = BLOCK_PREV_ALLOC;
+        } else if (block_size(next_block(block)) == 0) {
+            top = block;
+            prev_alloc = 0;
+        } else {
+            ((size_t*)next_block(block))[-1] = size | bin_epoch;
+            int bin = get_bin(size);
+            set_next(block, openalloc_free_lists[bin]);
+            openalloc_free_lists[bin] = block;
+            prev_alloc = 0;
+        }
+        block = next_block(block);
+    }
+}
+
+static void load_bins(void) {
+    for (int i = 0; i < NUM_BINS; i++) {
+        openalloc_free_lists[i] = OPENALLOC_LINK_DECODE(persist->bins[i]);
+    }
+    top = OPENALLOC_LINK_DECODE(persist->top);
+}
+
+static void save_bins(void) {
+    for (int i = 0; i < NUM_BINS; i++) {
+        persist->bins[i] = OPENALLOC_LINK_ENCODE(openalloc_free_lists[i]);
+    }
+    persist->top = OPENALLOC_LINK_ENCODE(top);
+}
+
+// Checks the header of a heap file mapped at base and makes it this
+// process's heap, with empty bins. NULL if it is not a heap we can use.
+static persist_header_t* open_heap_file(void* base, size_t size) {
+    persist_header_t* header = base;
+    if (!base || ((uintptr_t)base & (OPENALLOC_ALIGN - 1)) || size < PERSIST_HEADER_SIZE ||
+        header->magic != PERSIST_MAGIC || header->layout != PERSIST_LAYOUT || header->size != size ||
+        header->first_block < PERSIST_HEADER_SIZE || header->first_block >= size) {
+        return NULL;
+    }
+    
+    reset_heap(base, size, (uintptr_t)base);
+#ifdef OPENALLOC_SAFE_LINKING
+    openalloc_link_secret = header->secret;
+#endif
+    first_block = (block_header_t*)((uint8_t*)base + header->first_block);
+    bin_epoch = header->bin_epoch & 1;
+    return header;
+}
+
+int openalloc_attach(void* base, size_t size) {
+    persist_header_t* header = open_heap_file(base, size);
+    if (!header) return -1;
+    
+    int recovered = !header->clean || header->classes != class_checksum();
+    if (recovered) {
+        if (rebuild_bins() != 0) {
+            reset_heap(NULL, 0, 0);
+            return -1;
+        }
+        header->classes = class_checksum();
+    }
+    
+    persist = header;
+    if (!recovered) load_bins();
+    persist->clean = 0;
+    
+    // The blocks live in the file count towards the limits from the start.
+    for (block_header_t* block = first_block; block_size(block) != 0; block = next_block(block)) {
+        if (block->header & BLOCK_ALLOC) openalloc_used += block_size(block);
+    }
+    return recovered;
+}
+
+int openalloc_detach(void) {
+    if (!persist) return -1;
+    // A pass left running could empty the bins after they are saved.
+    openalloc_stop_background();
+    
+    // Other processes may still be using a shared heap; its bins are
+    // already in the header.
+    if (shared_unlocked) {
+        reset_heap(NULL, 0, 0);
+        return 0;
+    }
+    
+    openalloc_flush();
+    if (compact_cursor) compact_run(UINT64_MAX, 0);
+    save_bins();
+    persist->bin_epoch = bin_epoch;
+    persist->clean = 1;
+    int ret = msync(heap_start, heap_size, MS_SYNC) == 0 ? 0 : -1;
+    
+    reset_heap(NULL, 0, 0);
+    return ret;
+}
+
+static void shared_lock(void) {
+    uint32_t* lock = &persist->lock;
+    uint32_t state = 0;
+    if (LIKELY(__atomic_compare_exchange_n(lock, &state, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))) return;
+    
+    // Contended: mark the lock 2 so the holder wakes us on unlock. The
+    // futex is not FUTEX_PRIVATE since the waiters are other processes.
+    if (state != 2) state = __atomic_exchange_n(lock, 2, __ATOMIC_ACQUIRE);
+    while (state != 0) {
+        syscall(SYS_futex, lock, FUTEX_WAIT, 2, NULL, NULL, 0);
+        state = __atomic_exchange_n(lock, 2, __ATOMIC_ACQUIRE);
+    }
+}
+
+static void shared_unlock(void) {
+    if (__atomic_exchange_n(&persist->lock, 0, __ATOMIC_RELEASE) == 2) {
+        syscall(SYS_futex, &persist->lock, FUTEX_WAKE, 1, NULL, NULL, 0);
+    }
+}
+
+static void shared_enter(void) {
+    shared_lock();
+    load_bins();
+    shared_unlocked = 0;
+}
+
+static void shared_leave(void) {
+    save_bins();
+    memset(openalloc_free_lists, 0, sizeof(openalloc_free_lists));
+    top = NULL;
+    shared_unlocked = 1;
+    shared_unlock();
+}
+
+int openalloc_init_shared(void* base, size_t size) {
+    if (openalloc_init_persistent(base, size) != 0) return -1;
+    
+    persist->shared = 1;
+    persist->lock = 1;
+    shared_leave();
+    return 0;
+}
+
+int openalloc_attach_shared(void* base, size_t size) {
+    persist_header_t* header = open_heap_file(base, size);
+    if (!header || !header->shared || header->classes != class_checksum()) {
+        if (header) reset_heap(NULL, 0, 0);
+        return -1;
+    }
+    
+    persist = header;
+    shared_unlocked = 1;
+    return 0;
+}
+
+size_t openalloc_ptr_to_offset(const void* ptr) {
+    const uint8_t* p = ptr;
+    if (!persist || p < (uint8_t*)heap_start + PERSIST_HEADER_SIZE || p >= (uint8_t*)heap_start + heap_size) {
+        return 0;
+    }
+    return (size_t)(p - (uint8_t*)heap_start);
+}
+
+void* openalloc_offset_to_ptr(size_t offset) {
+    if (!persist || offset < PERSIST_HEADER_SIZE || offset >= heap_size) return NULL;
+    return (uint8_t*)heap_start + offset;
+}
+
+int openalloc_set_root(void* ptr) {
+    if (!persist || (ptr && !heap_contains(ptr))) return -1;
+    persist->root = OPENALLOC_LINK_ENCODE(ptr);
+    return 0;
+}
+
+void* openalloc_get_root(void) {
+    return persist ? (void*)OPENALLOC_LINK_DECODE(persist->root) : NULL;
+}
+
+// Calls until the next sampled allocation: uniform in [1, 2 * rate - 1] so
+// the mean is the rate but periodic allocation patterns don't alias with it.
+static size_t next_guard_countdown(void) {
+    guard_rng ^= guard_rng << 13;
+    guard_rng ^= guard_rng >> 7;
+    guard_rng ^= guard_rng << 17;
+    return 1 + (size_t)(guard_rng % (2 * openalloc_guard_rate - 1));
+}
+
+static void* guarded_malloc(size_t size) {
+    guard_countdown = openalloc_guard_rate ? next_guard_countdown() : 0;
+    
+    size_t aligned_size = align_size(size);
+    if (!openalloc_guard_rate || guard_fifo_count == 0 || aligned_size + HEADER_SIZE > page_size) return NULL;
+    
+    int slot = guard_fifo[guard_fifo_head];
+    uint8_t* page = guard_pool + (2 * (size_t)slot + 1) * page_size;
+    if (mprotect(page, page_size, PROT_READ | PROT_WRITE) != 0) return NULL;
+    guard_fifo_head = (guard_fifo_head + 1) % GUARD_SLOTS;
+    guard_fifo_count--;
+    
+    block_header_t* block = (block_header_t*)(page + page_size - aligned_size - HEADER_SIZE);
+    init_block(block, aligned_size | BLOCK_ALLOC | BLOCK_GUARDED);
+    return get_data(block);
+}
+
+static void guarded_free(block_header_t* block) {
+    uint8_t* page = (uint8_t*)((uintptr_t)block & ~(uintptr_t)(page_size - 1));
+    mprotect(page, page_size, PROT_NONE);
+    
+    int slot = (int)((size_t)(page - guard_pool) / page_size / 2);
+    guard_fifo[(guard_fifo_head + guard_fifo_count) % GUARD_SLOTS] = (uint16_t)slot;
+    guard_fifo_count++;
+}
+
+int openalloc_set_guard_sample_rate(size_t rate) {
+    if (heap_lock_needed()) {
+        heap_lock();
+        int ret = openalloc_set_guard_sample_rate(rate);
+        heap_unlock();
+        return ret;
+    }
+    if (rate && persist) return -1;    // guarded objects would live outside the file
+    if (rate && !guard_pool) {
+        page_size = (size_t)sysconf(_SC_PAGESIZE);
+        void* pool = mmap(NULL, (2 * GUARD_SLOTS + 1) * page_size, PROT_NONE,
+                          MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (pool == MAP_FAILED) return -1;
+        guard_pool = pool;
+        reset_guard_pool();
+    }
+    openalloc_guard_rate = rate;
+    guard_countdown = rate ? next_guard_countdown() : 0;
+    return 0;
+}
+
+static inline uintptr_t* pagemap_slot(const void* ptr, int create) {
+    uintptr_t key = (uintptr_t)ptr >> SLAB_SHIFT;
+    uintptr_t root = key >> PAGEMAP_LEAF_BITS;
+    if (UNLIKELY(root >= ((uintptr_t)1 << PAGEMAP_ROOT_BITS))) return NULL;
+    
+    uintptr_t* leaf = pagemap_root[root];
+    if (UNLIKELY(!leaf)) {
+        if (!create) return NULL;
+        leaf = map_segment(sizeof(uintptr_t) << PAGEMAP_LEAF_BITS);
+        if (!leaf) return NULL;
+        pagemap_root[root] = leaf;
+    }
+    return &leaf[key & (((uintptr_t)1 << PAGEMAP_LEAF_BITS) - 1)];
+}
+
+// slab | bin for a pointer into a live slab, 0 for anything else.
+static inline uintptr_t pagemap_get(const void* ptr) {
+    uintptr_t* slot = pagemap_slot(ptr, 0);
+    return slot ? *slot : 0;
+}
+
+static inline slab_obj_t* slab_obj_next(const slab_obj_t* obj) {
+    slab_obj_t* next = (slab_obj_t*)OPENALLOC_REVEAL(&obj->next, obj->next);
+#ifdef OPENALLOC_SAFE_LINKING
+    if (UNLIKELY(!OPENALLOC_LINK_OK(next))) heap_fail("corrupted slab free list link", obj);
+#endif
+    return next;
+}
+
+static inline slab_t** node_slabs(int node) {
+    return node == active_node ? slab_lists : node_heaps[node].slabs;
+}
+
+static inline void slab_unlink(slab_t* slab) {
+    if (slab->prev) {
+        slab->prev->next = slab->next;
+    } else {
+        node_slabs(slab->node)[slab->bin] = slab->next;
+    }
+    if (slab->next) slab->next->prev = slab->prev;
+    slab->next = slab->prev = NULL;
+}
+
+static inline void slab_push(slab_t* slab) {
+    slab_t** head = &node_slabs(slab->node)[slab->bin];
+    slab->prev = NULL;
+    slab->next = *head;
+    if (slab->next) slab->next->prev = slab;
+    *head = slab;
+}
+
+// With huge pages on, slabs come from HUGE_PAGE_SIZE arenas carved out of
+// the heap, so the slabs of every class sit together on a few huge pages
+// instead of scattering between larger blocks. Arena slabs that empty are
+// kept for reuse rather than returned to the bins.
+static slab_t* arena_slab(void) {
+    slab_t* slab = slab_arena.spare;
+    if (slab) {
+        slab_arena.spare = slab->next;
+        return slab;
+    }
+    if (slab_arena.next == slab_arena.end) {
+        uint8_t* arena = aligned_malloc(HUGE_PAGE_SIZE, HUGE_PAGE_SIZE);
+        if (!arena) return NULL;
+        slab_arena.next = arena;
+        slab_arena.end = arena + HUGE_PAGE_SIZE;
+    }
+    slab = (slab_t*)slab_arena.next;
+    slab_arena.next += SLAB_SIZE;
+    return slab;
+}
+
+static slab_t* new_slab(int bin) {
+    int in_arena = 0;
+    slab_t* slab = NULL;
+    if (huge_pages) {
+        slab = arena_slab();
+        in_arena = slab != NULL;
+    }
+    if (!slab) slab = aligned_malloc(SLAB_SIZE, SLAB_SIZE);
+    if (!slab) return NULL;
+    
+    uintptr_t* entry = pagemap_slot(slab, 1);
+    if (!entry) {
+        if (in_arena) {
+            slab->next = slab_arena.spare;
+            slab_arena.spare = slab;
+        } else {
+            push_free_node(get_block(slab), active_node);
+        }
+        return NULL;
+    }
+    *entry = (uintptr_t)slab | (uintptr_t)active_node << PAGEMAP_NODE_SHIFT | (uintptr_t)bin;
+    
+    slab->free = NULL;
+    slab->bump = (uint8_t*)slab + ((sizeof(slab_t) + 15) & ~(size_t)15);
+    slab->end = (uint8_t*)slab + SLAB_SIZE;
+    slab->used = 0;
+    slab->obj_size = openalloc_class_sizes[bin];
+    slab->bin = bin;
+    slab->node = active_node;
+    slab->in_arena = in_arena;
+    slab_push(slab);
+    slabs_live++;
+    return slab;
+}
+
+static void free_slab(slab_t* slab) {
+    slab_unlink(slab);
+    *pagemap_slot(slab, 0) = (uintptr_t)slab->node << PAGEMAP_NODE_SHIFT;
+    slabs_live--;
+    if (slab->in_arena) {
+        slab_arena_t* arena = slab->node == active_node ? &slab_arena : &node_heaps[slab->node].arena;
+        slab->next = arena->spare;
+        arena->spare = slab;
+        return;
+    }
+    push_free_node(get_block(slab), slab->node);
+}
+
+// Drops the page map entries of every slab (full ones included) and NUMA
+// segment ahead of a heap reset.
+static void clear_pagemap(void) {
+    region_t primary = {regions, heap_size, 0, 0};
+    for (region_t* region = &primary; region; region = region->next) {
+        uint8_t* start = region == &primary ? (uint8_t*)heap_start : (uint8_t*)region;
+        uint8_t* p = (uint8_t*)((uintptr_t)start & ~(uintptr_t)(SLAB_SIZE - 1));
+        for (; p < start + region->size; p += SLAB_SIZE) {
+            uintptr_t* slot = pagemap_slot(p, 0);
+            if (slot) *slot = 0;
+        }
+    }
+    for (int bin = 0; bin < NUM_BINS; bin++) {
+        slab_lists[bin] = NULL;
+    }
+    slabs_live = 0;
+}
+
+static inline int slab_full(const slab_t* slab) {
+    return !slab->free && slab->bump + slab->obj_size > slab->end;
+}
+
+static void* slab_malloc(int bin) {
+    slab_t* slab = slab_lists[bin];
+    if (UNLIKELY(!slab)) {
+        slab = new_slab(bin);
+        if (!slab) return NULL;
+    }
+    
+    void* obj;
+    if (slab->free) {
+        obj = slab->free;
+        slab->free = slab_obj_next(slab->free);
+    } else {
+        obj = slab->bump;
+        slab->bump += slab->obj_size;
+    }
+    slab->used++;
+    if (slab_full(slab)) slab_unlink(slab);
+    return obj;
+}
+
+static void slab_free(uintptr_t entry, void* ptr) {
+    slab_t* slab = (slab_t*)(entry & PAGEMAP_SLAB_MASK);
+    slab_obj_t* obj = ptr;
+    DEBUG_CHECK((uint8_t*)ptr < slab->bump &&
+                ((size_t)((uint8_t*)ptr - (uint8_t*)slab - ((sizeof(slab_t) + 15) & ~(size_t)15)) % slab->obj_size) == 0,
+                "free of a pointer into the middle of a slab object", ptr);
+    
+    if (slab_full(slab)) slab_push(slab);
+    obj->next = (slab_obj_t*)OPENALLOC_PROTECT(&obj->next, slab->free);
+    slab->free = obj;
+    
+    // Keep one empty slab per bin around; give the rest back to the heap.
+    if (--slab->used == 0 && (slab->next || slab->prev)) free_slab(slab);
+}
+
+int openalloc_set_slab_max(size_t max_size) {
+    if (heap_lock_needed()) {
+        heap_lock();
+        int ret = openalloc_set_slab_max(max_size);
+        heap_unlock();
+        return ret;
+    }
+    // Slab metadata and the page map hold raw addresses, so a persistent
+    // heap keeps every object in ordinary blocks.
+    if (max_size > OPENALLOC_CLASS_MAX || (max_size && persist)) return -1;
+    slab_max = max_size ? openalloc_class_sizes[get_bin(max_size)] : 0;
+    return 0;
+}
+
+// Highest possible node + 1 from sysfs, read without allocating so the
+// LD_PRELOAD shim can call this before its heap is up. 1 if unknown.
+static int count_numa_nodes(void) {
+    char buf[64];
+    int fd = open("/sys/devices/system/node/possible", O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return 1;
+    ssize_t len = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (len <= 0) return 1;
+    
+    // "0", "0-1" or "0,2-3": the last number is the highest node.
+    int last = 0;
+    for (ssize_t i = 0; i < len; i++) {
+        if (buf[i] >= '0' && buf[i] <= '9') {
+            last = last * 10 + (buf[i] - '0');
+        } else if (buf[i] != '\n') {
+            last = 0;
+        }
+    }
+    return last + 1 < MAX_NODES ? last + 1 : MAX_NODES;
+}
+
+// Switches the bins and slab lists over to the calling thread's node.
+static void select_node(void) {
+    // A single node is always the active one; no getcpu on the hot path.
+    if (numa_nodes <= 1) return;
+    unsigned int cpu, node;
+    if (getcpu(&cpu, &node) != 0 || node >= (unsigned int)numa_nodes) node = 0;
+    if ((int)node == active_node) return;
+    
+    memcpy(node_heaps[active_node].bins, openalloc_free_lists, sizeof(openalloc_free_lists));
+    memcpy(node_heaps[active_node].slabs, slab_lists, sizeof(slab_lists));
+    node_heaps[active_node].top = top;
+    node_heaps[active_node].arena = slab_arena;
+    memcpy(openalloc_free_lists, node_heaps[node].bins, sizeof(openalloc_free_lists));
+    memcpy(slab_lists, node_heaps[node].slabs, sizeof(slab_lists));
+    top = node_heaps[node].top;
+    slab_arena = node_heaps[node].arena;
+    active_node = (int)node;
+}
+
+int openalloc_set_huge_pages(int enable) {
+    if (heap_lock_needed()) {
+        heap_lock();
+        int ret = openalloc_set_huge_pages(enable);
+        heap_unlock();
+        return ret;
+    }
+    huge_pages = enable != 0;
+    if (!huge_pages) return 0;
+    
+    // Memory the heap already has only gets the advice; it is not remapped.
+    advise_huge_pages(heap_start, heap_size);
+    for (region_t* region = regions; region; region = region->next) {
+        advise_huge_pages(region, region->size);
+    }
+    return 0;
+}
+
+int openalloc_set_numa(int enable) {
+    if (heap_lock_needed()) {
+        heap_lock();
+        int ret = openalloc_set_numa(enable);
+        heap_unlock();
+        return ret;
+    }
+    if (!enable) return numa_nodes ? -1 : 0;
+    if (numa_nodes) return 0;
+    if (!segment_size || deferred_enabled || lifetime_heaps) return -1;
+    
+    if (compact_cursor) compact_run(UINT64_MAX, 0);
+    numa_nodes = count_numa_nodes();
+    openalloc_numa_enabled = numa_nodes > 1;
+    return 0;
+}
+
+// First fit from bins, then a cut off the front of *top_ptr. NULL if
+// neither has room.
+static inline __attribute__((always_inline)) void* take_block(block_header_t** bins, block_header_t** top_ptr,
+                                                                size_t aligned_size) {
+    int start_bin = get_bin(aligned_size);
+    
+    for (int bin = start_bin; bin < NUM_BINS; bin++) {
+        block_header_t* prev = NULL;
+        block_header_t* block = bins[bin];
+        
+        while (LIKELY(block != NULL)) {
+            DEBUG_CHECK(valid_block(block) && !(block->header & BLOCK_ALLOC), "corrupt free list entry", block);
+            size_t bsize = block_size(block);
+            if (LIKELY(!(block->header & BLOCK_ALLOC)) && LIKELY(bsize >= aligned_size)) {
+                block_header_t* original_next = get_next(block);
+                block_header_t* replacement = original_next;
+                __builtin_prefetch(original_next, 1);
+                
+                if (LIKELY(bsize >= aligned_size + OPENALLOC_MIN_BLOCK + HEADER_SIZE)) {
+                    block_header_t* new_block = (block_header_t*)((uint8_t*)block + HEADER_SIZE + aligned_size);
+                    size_t new_size = bsize - aligned_size - HEADER_SIZE;
+                    init_block(new_block, new_size | BLOCK_PREV_ALLOC);
+                    ((size_t*)next_block(new_block))[-1] = new_size | bin_epoch;
+                    
+                    block->header = aligned_size | (block->header & BLOCK_PREV_ALLOC);
+                    
+                    int new_bin = get_bin(new_size);
+                    
+                    // The remainder takes the block's place when it stays
+                    // in the same bin.
+                    if (LIKELY(new_bin == bin)) {
+                        set_next(new_block, original_next);
+                        replacement = new_block;
+                    } else {
+                        set_next(new_block, bins[new_bin]);
+                        bins[new_bin] = new_block;
+                    }
+                } else {
+                    next_block(block)->header |= BLOCK_PREV_ALLOC;
+                }
+                
+                block->header |= BLOCK_ALLOC;
+                if (prev) {
+                    set_next(prev, replacement);
+                } else {
+                    bins[bin] = replacement;
+                }
+                
+                return get_data(block);
+            }
+            prev = block;
+            block = get_next(block);
+        }
+    }
+    
+    block_header_t* block = *top_ptr;
+    if (LIKELY(block != NULL) && block_size(block) >= aligned_size) {
+        size_t bsize = block_size(block);
+        if (LIKELY(bsize >= aligned_size + OPENALLOC_MIN_BLOCK + HEADER_SIZE)) {
+            *top_ptr = (block_header_t*)((uint8_t*)block + HEADER_SIZE + aligned_size);
+            init_block(*top_ptr, (bsize - aligned_size - HEADER_SIZE) | BLOCK_PREV_ALLOC);
+            block->header = aligned_size | (block->header & BLOCK_PREV_ALLOC) | BLOCK_ALLOC;
+        } else {
+            *top_ptr = NULL;
+            next_block(block)->header |= BLOCK_PREV_ALLOC;
+            block->header |= BLOCK_ALLOC;
+        }
+        return get_data(block);
+    }
+    return NULL;
+}
+
+static void* bin_malloc(size_t size) {
+    size_t aligned_size = align_size(size);
+    void* ptr = take_block(openalloc_free_lists, &top, aligned_size);
+    if (LIKELY(ptr != NULL)) return ptr;
+    
+    // Free blocks a compaction pass has not reached are in no bin yet.
+    if (UNLIKELY(compact_cursor != NULL)) {
+        compact_run(UINT64_MAX, 0);
+        return bin_malloc(size);
+    }
+    
+    if (UNLIKELY(deferred_count != 0)) {
+        openalloc_flush();
+        return bin_malloc(size);
+    }
+    
+    if (UNLIKELY(segment_size != 0) && grow_heap(aligned_size)) {
+        return bin_malloc(size);
+    }
+    
+    return NULL;
+}
+
+static void notify_pressure(int level, size_t size) {
+    if (!pressure_fn || in_pressure) return;
+    in_pressure = 1;
+    pressure_fn(level, openalloc_used, size, pressure_arg);
+    in_pressure = 0;
+}
+
+// Slow path of a request that would take usage past openalloc_limit_low;
+// size is what the block will be charged. The callback runs before the
+// heap is touched, so it may free (or allocate, without being called
+// again). 0 if the request must fail.
+static int admit(size_t size) {
+    if (size > SIZE_MAX - openalloc_used) return 0;
+    if (limit_soft && openalloc_used <= limit_soft && openalloc_used + size > limit_soft) {
+        notify_pressure(OPENALLOC_PRESSURE_SOFT, size);
+    }
+    if (limit_hard && openalloc_used + size > limit_hard) {
+        notify_pressure(OPENALLOC_PRESSURE_HARD, size);
+        return openalloc_used <= limit_hard && size <= limit_hard - openalloc_used;
+    }
+    return 1;
+}
+
+#define LIMIT_CHECK(size) \
+    (LIKELY(openalloc_used + (size) <= openalloc_limit_low) || admit(size))
+
+// Charges a new block from the bins or a chunk heap. LIMIT_CHECK admitted
+// its rounded size, but a block too small to split is handed out whole,
+// up to a minimum block larger; if that crosses the hard limit the block
+// goes back and the request fails.
+static inline void* charge_block(void* ptr) {
+    openalloc_used += block_size(get_block(ptr));
+    if (UNLIKELY(openalloc_used > openalloc_limit_low) && limit_hard && openalloc_used > limit_hard) {
+        openalloc_free(ptr);
+        return NULL;
+    }
+    return ptr;
+}
+
+int openalloc_set_limits(size_t soft, size_t hard) {
+    if (heap_lock_needed()) {
+        heap_lock();
+        int ret = openalloc_set_limits(soft, hard);
+        heap_unlock();
+        return ret;
+    }
+    // A shared heap's usage is every process's, and this count is ours.
+    if (!first_block || shared_unlocked || (persist && persist->shared) || (hard && soft > hard)) return -1;
+    limit_soft = soft;
+    limit_hard = hard;
+    openalloc_limit_low = soft ? soft : hard ? hard : SIZE_MAX;
+    return 0;
+}
+
+void openalloc_set_pressure_callback(openalloc_pressure_fn fn, void* arg) {
+    if (heap_lock_needed()) {
+        heap_lock();
+        openalloc_set_pressure_callback(fn, arg);
+        heap_unlock();
+        return;
+    }
+    pressure_fn = fn;
+    pressure_arg = arg;
+}
+
+size_t openalloc_in_use(void) {
+    return openalloc_used;
+}
+
+static void* shared_malloc(size_t size) {
+    shared_enter();
+    void* ptr = openalloc_malloc(size);
+    shared_leave();
+    return ptr;
+}
+
+void* openalloc_malloc(size_t size) {
+    if (UNLIKELY(size == 0 || size > MAX_REQUEST)) return NULL;
+    if (heap_lock_needed()) {
+        heap_lock();
+        void* ret = openalloc_malloc(size);
+        heap_unlock();
+        return ret;
+    }
+    if (UNLIKELY(shared_unlocked)) return shared_malloc(size);
+    // Checked at what will be charged: the slab class, or the rounded size.
+    if (!LIMIT_CHECK(size <= slab_max ? openalloc_class_sizes[get_bin(size)] : align_size(size))) return NULL;
+    if (UNLIKELY(openalloc_tagging) && current_tag && !numa_nodes && !persist) {
+        return tagged_malloc(size, current_tag);
+    }
+    
+    // With sampling off the countdown starts at zero and only wraps back
+    // after 2^64 calls, so this costs one decrement and branch.
+    if (UNLIKELY(--guard_countdown == 0)) {
+        void* ptr = guarded_malloc(size);
+        if (ptr) {
+            openalloc_used += block_size(get_block(ptr));
+            return ptr;
+        }
+    }
+    
+    if (numa_nodes) select_node();
+    
+    if (size <= slab_max) {
+        int bin = get_bin(size);
+        void* ptr = slab_malloc(bin);
+        if (LIKELY(ptr != NULL)) {
+            openalloc_used += openalloc_class_sizes[bin];
+            return ptr;
+        }
+    }
+    
+    void* ptr = bin_malloc(size);
+    return LIKELY(ptr != NULL) ? charge_block(ptr) : NULL;
+}
+
+// An alignment-aligned block from the bins of the running node, for
+// openalloc_memalign and for the slabs and chunks the allocator carves
+// for itself. Over-allocates so the aligned payload leaves room for a
+// free block in front of it, then hands the leading and trailing slack
+// back to the bins.
+static void* aligned_malloc(size_t alignment, size_t size) {
+    size_t lead_min = HEADER_SIZE + OPENALLOC_MIN_BLOCK;
+    if (alignment > MAX_REQUEST / 2 || size > MAX_REQUEST - alignment - lead_min) return NULL;
+    size_t aligned_size = align_size(size);
+    uint8_t* raw = bin_malloc(aligned_size + alignment + lead_min);
+    if (!raw) return NULL;
+    
+    uint8_t* target = raw;
+    block_header_t* aligned_block = get_block(raw);
+    if ((uintptr_t)raw & (alignment - 1)) {
+        target = (uint8_t*)(((uintptr_t)raw + lead_min + alignment - 1) & ~(uintptr_t)(alignment - 1));
+        block_header_t* block = get_block(raw);
+        aligned_block = get_block(target);
+        
+        init_block(aligned_block, (block_size(block) - (size_t)(target - raw)) | BLOCK_ALLOC);
+        block->header = ((size_t)(target - raw) - HEADER_SIZE) | (block->header & BLOCK_PREV_ALLOC);
+        push_free(block);
+    }
+    
+    // An already aligned block has all of the over-allocation behind it.
+    if (block_size(aligned_block) >= aligned_size + lead_min) {
+        block_header_t* tail = (block_header_t*)(target + aligned_size);
+        init_block(tail, (block_size(aligned_block) - aligned_size - HEADER_SIZE) | BLOCK_PREV_ALLOC);
+        aligned_block->header = aligned_size | (aligned_block->header & BLOCK_PREV_ALLOC) | BLOCK_ALLOC;
+        push_free(tail);
+    }
+    
+    return target;
+}
+
+void* openalloc_memalign(size_t alignment, size_t size) {
+    if (alignment <= OPENALLOC_ALIGN) return openalloc_malloc(size);
+    if (alignment & (alignment - 1)) return NULL;
+    if (size == 0) return NULL;
+    if (heap_lock_needed()) {
+        heap_lock();
+        void* ret = openalloc_memalign(alignment, size);
+        heap_unlock();
+        return ret;
+    }
+    if (UNLIKELY(shared_unlocked)) {
+        shared_enter();
+        void* ptr = openalloc_memalign(alignment, size);
+        shared_leave();
+        return ptr;
+    }
+    if (!LIMIT_CHECK(align_size(size))) return NULL;
+    
+    if (numa_nodes) select_node();
+    void* ptr = aligned_malloc(alignment, size);
+    return ptr ? charge_block(ptr) : NULL;
+}
+
+// A SLAB_SIZE-aligned block of size bytes from the main heap, entered in
+// the page map as a region chunk of node, or as a bump chunk for node 0.
+static uint8_t* alloc_lifetime_chunk(size_t size, int node) {
+    // The pass would bin the free blocks of a region chunk in the main heap.
+    if (compact_cursor) compact_run(UINT64_MAX, 0);
+    uint8_t* chunk = aligned_malloc(SLAB_SIZE, size);
+    if (!chunk) return NULL;
+    for (uint8_t* p = chunk; p < chunk + size; p += SLAB_SIZE) {
+        if (!pagemap_slot(p, 1)) {
+            push_free(get_block(chunk));
+            return NULL;
+        }
+    }
+    uintptr_t entry = node ? (uintptr_t)node << PAGEMAP_NODE_SHIFT : (uintptr_t)chunk | PAGEMAP_BUMP;
+    for (uint8_t* p = chunk; p < chunk + size; p += SLAB_SIZE) {
+        *pagemap_slot(p, 0) = entry;
+    }
+    lifetime_heaps = 1;
+    return chunk;
+}
+
+static void free_lifetime_chunk(uint8_t* chunk, size_t size) {
+    for (uint8_t* p = chunk; p < chunk + size; p += SLAB_SIZE) {
+        *pagemap_slot(p, 0) = 0;
+    }
+    push_free(get_block(chunk));
+}
+
+static inline void reset_bump_chunk(bump_chunk_t* chunk) {
+    chunk->bump = (uint8_t*)(chunk + 1);
+    chunk->live = 0;
+    init_block((block_header_t*)chunk->bump, BLOCK_ALLOC | BLOCK_PREV_ALLOC);
+}
+
+static void* bump_malloc(size_t aligned_size) {
+    bump_chunk_t* chunk = bump_current;
+    if (UNLIKELY(!chunk || chunk->bump + HEADER_SIZE + aligned_size + FENCE_SIZE > chunk->end)) {
+        // A full chunk is left to its live blocks; the last free recycles it.
+        chunk = bump_spare;
+        if (chunk) {
+            bump_spare = NULL;
+        } else {
+            chunk = (bump_chunk_t*)alloc_lifetime_chunk(LIFETIME_CHUNK, 0);
+            if (!chunk) return NULL;
+            chunk->end = (uint8_t*)chunk + LIFETIME_CHUNK;
+        }
+        reset_bump_chunk(chunk);
+        bump_current = chunk;
+    }
+    
+    // The fence at the bump pointer becomes the block, and a new fence
+    // goes after it.
+    block_header_t* block = (block_header_t*)chunk->bump;
+    block->header = aligned_size | BLOCK_ALLOC | BLOCK_PREV_ALLOC;
+    chunk->bump += HEADER_SIZE + aligned_size;
+    init_block((block_header_t*)chunk->bump, BLOCK_ALLOC | BLOCK_PREV_ALLOC);
+    chunk->live++;
+    return get_data(block);
+}
+
+static void bump_free(uintptr_t entry, void* ptr) {
+    bump_chunk_t* chunk = (bump_chunk_t*)(entry & PAGEMAP_SLAB_MASK);
+    block_header_t* block = get_block(ptr);
+    DEBUG_CHECK(block->header & BLOCK_ALLOC, "double free", ptr);
+    block->header &= ~BLOCK_ALLOC;
+    if (--chunk->live != 0) return;
+    
+    // One empty chunk is kept besides the current one.
+    if (chunk == bump_current) {
+        reset_bump_chunk(chunk);
+    } else if (!bump_spare) {
+        bump_spare = chunk;
+    } else {
+        free_lifetime_chunk((uint8_t*)chunk, LIFETIME_CHUNK);
+    }
+}
+
+// Gives the heap of a longer lifetime a new chunk, big enough for
+// aligned_size, as its top.
+static int add_region_chunk(int node, size_t aligned_size) {
+    size_t size = LIFETIME_CHUNK;
+    size_t overhead = sizeof(region_t) + HEADER_SIZE + FENCE_SIZE;
+    if (aligned_size + overhead > size) size = (aligned_size + overhead + SLAB_SIZE - 1) & ~(SLAB_SIZE - 1);
+    
+    uint8_t* chunk = alloc_lifetime_chunk(size, node);
+    if (!chunk) return 0;
+    
+    node_heap_t* heap = &node_heaps[node];
+    bin_top(heap->bins, &heap->top);
+    heap->top = add_region_node(chunk, size, node);
+    return 1;
+}
+
+// A block from the chunk-grown heap in node_heaps[node].
+static void* chunk_malloc(int node, size_t aligned_size) {
+    node_heap_t* heap = &node_heaps[node];
+    void* ptr = take_block(heap->bins, &heap->top, aligned_size);
+    if (LIKELY(ptr != NULL) || !add_region_chunk(node, aligned_size)) return ptr;
+    return take_block(heap->bins, &heap->top, aligned_size);
+}
+
+void* openalloc_malloc_hint(size_t size, int hint) {
+    if (heap_lock_needed()) {
+        heap_lock();
+        void* ret = openalloc_malloc_hint(size, hint);
+        heap_unlock();
+        return ret;
+    }
+    // NUMA heaps own node_heaps, and a file heap's page map entries would
+    // not outlive the process.
+    if (hint < OPENALLOC_HINT_SHORT || hint > OPENALLOC_HINT_PERMANENT || numa_nodes || persist) {
+        return openalloc_malloc(size);
+    }
+    if (UNLIKELY(size == 0 || size > MAX_REQUEST)) return NULL;
+    
+    // A short-lived block too big to share a chunk is an ordinary one.
+    size_t aligned_size = align_size(size);
+    if (hint == OPENALLOC_HINT_SHORT && aligned_size > LIFETIME_CHUNK / 4) return openalloc_malloc(size);
+    if (!LIMIT_CHECK(aligned_size)) return NULL;
+    
+    void* ptr = hint == OPENALLOC_HINT_SHORT ? bump_malloc(aligned_size)
+                                             : chunk_malloc(hint - OPENALLOC_HINT_SHORT, aligned_size);
+    return LIKELY(ptr != NULL) ? charge_block(ptr) : NULL;
+}
+
+static void* tagged_malloc(size_t size, int tag) {
+    void* ptr = chunk_malloc(TAG_NODE(tag), align_size(size));
+    if (UNLIKELY(ptr == NULL)) return NULL;
+    tag_stats[tag].live_bytes += block_size(get_block(ptr));
+    tag_stats[tag].live_blocks++;
+    return charge_block(ptr);
+}
+
+int openalloc_set_tag(int tag) {
+    if (tag < 0 || tag >= OPENALLOC_MAX_TAGS) return -1;
+    int prev = current_tag;
+    if (!prev != !tag) __atomic_add_fetch(&openalloc_tagging, tag ? 1 : -1, __ATOMIC_RELAXED);
+    current_tag = tag;
+    return prev;
+}
+
+void* openalloc_malloc_tagged(size_t size, int tag) {
+    if (heap_lock_needed()) {
+        heap_lock();
+        void* ret = openalloc_malloc_tagged(size, tag);
+        heap_unlock();
+        return ret;
+    }
+    // Tags share node_heaps with NUMA heaps, and a file heap's page map
+    // entries would not outlive the process.
+    if (tag <= 0 || tag >= OPENALLOC_MAX_TAGS || numa_nodes || persist) return openalloc_malloc(size);
+    if (UNLIKELY(size == 0 || size > MAX_REQUEST) || !LIMIT_CHECK(align_size(size))) return NULL;
+    return tagged_malloc(size, tag);
+}
+
+int openalloc_get_tag_stats(int tag, openalloc_tag_stats_t* stats) {
+    if (tag <= 0 || tag >= OPENALLOC_MAX_TAGS || !stats) return -1;
+    if (heap_lock_needed()) {
+        heap_lock();
+        int ret = openalloc_get_tag_stats(tag, stats);
+        heap_unlock();
+        return ret;
+    }
+    *stats = tag_stats[tag];
+    stats->heap_bytes = 0;
+    if (lifetime_heaps) {
+        for (region_t* region = regions; region; region = region->next) {
+            if (region->node == (size_t)TAG_NODE(tag)) stats->heap_bytes += region->size;
+        }
+    }
+    return 0;
+}
+
+int openalloc_reserve(size_t size, size_t count) {
+    if (size == 0 || size > MAX_REQUEST || !first_block) return -1;
+    if (heap_lock_needed()) {
+        heap_lock();
+        int ret = openalloc_reserve(size, count);
+        heap_unlock();
+        return ret;
+    }
+    if (UNLIKELY(shared_unlocked)) {
+        shared_enter();
+        int ret = openalloc_reserve(size, count);
+        shared_leave();
+        return ret;
+    }
+    if (numa_nodes) select_node();
+    
+    // Carve all of them before releasing any, chained through their first
+    // word, so each is a block of its own; they are binned even when they
+    // end against the top. Released in reverse, the lowest address ends up
+    // at the head of the bin.
+    void* carved = NULL;
+    size_t n = 0;
+    for (; n < count; n++) {
+        void* ptr = size <= slab_max ? slab_malloc(get_bin(size)) : NULL;
+        if (!ptr && !(ptr = bin_malloc(size))) break;
+        *(void**)ptr = carved;
+        carved = ptr;
+    }
+    while (carved) {
+        void* next = *(void**)carved;
+        uintptr_t entry = slabs_live ? pagemap_get(carved) : 0;
+        if (entry & PAGEMAP_SLAB_MASK) {
+            slab_free(entry, carved);
+        } else {
+            bin_block(get_block(carved));
+        }
+        carved = next;
+    }
+    return n == count ? 0 : -1;
+}
+
+int openalloc_prefault(void) {
+    if (heap_lock_needed()) {
+        heap_lock();
+        int ret = openalloc_prefault();
+        heap_unlock();
+        return ret;
+    }
+    if (!first_block) return -1;
+    if (!page_size) page_size = (size_t)sysconf(_SC_PAGESIZE);
+    
+    // A heap file is read ahead rather than dirtied page by page, which
+    // would make the next msync write all of it back.
+    region_t primary = {regions, heap_size, 0, 0};
+    for (region_t* region = &primary; region; region = region->next) {
+        uint8_t* start = region == &primary ? (uint8_t*)heap_start : (uint8_t*)region;
+        if (persist) {
+            madvise(start, region->size, MADV_WILLNEED);
+        } else {
+            prefault_range(start, region->size);
+        }
+    }
+    prefault_segments = 1;
+    return 0;
+}
+
+static handle_slot_t* new_handle_slot(void) {
+    if (handle_free) {
+        handle_slot_t* slot = &handles[handle_free - 1];
+        handle_free = slot->next_free;
+        return slot;
+    }
+    if (handle_top == handle_cap) {
+        size_t cap = handle_cap ? 2 * handle_cap : 1024;
+        if (cap > UINT32_MAX) return NULL;
+        handle_slot_t* table = map_segment(cap * sizeof(handle_slot_t));
+        if (!table) return NULL;
+        if (handles) {
+            memcpy(table, handles, handle_cap * sizeof(handle_slot_t));
+            munmap(handles, handle_cap * sizeof(handle_slot_t));
+        }
+        handles = table;
+        handle_cap = cap;
+    }
+    return &handles[handle_top++];
+}
+
+static void release_handle_slot(handle_slot_t* slot) {
+    slot->block = NULL;
+    slot->next_free = handle_free;
+    handle_free = (uint32_t)(slot - handles) + 1;
+}
+
+static inline handle_slot_t* handle_slot(openalloc_handle_t handle) {
+    if (UNLIKELY(handle == 0 || handle > handle_top || !handles[handle - 1].block)) return NULL;
+    return &handles[handle - 1];
+}
+
+openalloc_handle_t openalloc_halloc(size_t size) {
+    if (heap_lock_needed()) {
+        heap_lock();
+        openalloc_handle_t ret = openalloc_halloc(size);
+        heap_unlock();
+        return ret;
+    }
+    // Straight from the bins: slab objects and guarded allocations cannot
+    // move, and neither can the blocks of a NUMA or shared heap, whose
+    // bins compaction does not own.
+    if (size == 0 || size > MAX_REQUEST || numa_nodes || shared_unlocked) return 0;
+    if (!LIMIT_CHECK(align_size(size + HANDLE_WORD))) return 0;
+    
+    handle_slot_t* slot = new_handle_slot();
+    if (!slot) return 0;
+    size_t* data = bin_malloc(size + HANDLE_WORD);
+    if (!data || !charge_block(data)) {
+        release_handle_slot(slot);
+        return 0;
+    }
+    *data = (size_t)(slot - handles);
+    slot->block = get_block(data);
+    slot->locks = 0;
+    return (openalloc_handle_t)(slot - handles) + 1;
+}
+
+void* openalloc_hlock(openalloc_handle_t handle) {
+    if (heap_lock_needed()) {
+        heap_lock();
+        void* ret = openalloc_hlock(handle);
+        heap_unlock();
+        return ret;
+    }
+    handle_slot_t* slot = handle_slot(handle);
+    if (!slot) return NULL;
+    slot->locks++;
+    return (uint8_t*)get_data(slot->block) + HANDLE_WORD;
+}
+
+void openalloc_hunlock(openalloc_handle_t handle) {
+    if (heap_lock_needed()) {
+        heap_lock();
+        openalloc_hunlock(handle);
+        heap_unlock();
+        return;
+    }
+    handle_slot_t* slot = handle_slot(handle);
+    if (slot && slot->locks) slot->locks--;
+}
+
+void openalloc_hfree(openalloc_handle_t handle) {
+    if (heap_lock_needed()) {
+        heap_lock();
+        openalloc_hfree(handle);
+        heap_unlock();
+        return;
+    }
+    handle_slot_t* slot = handle_slot(handle);
+    if (!slot) return;
+    openalloc_free(get_data(slot->block));
+    release_handle_slot(slot);
+}
+
+static inline handle_slot_t* block_handle(block_header_t* block) {
+    size_t index = *(size_t*)get_data(block);
+    return index < handle_top && handles[index].block == block ? &handles[index] : NULL;
+}
+
+static uint64_t now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+static inline int in_bin(block_header_t* block) {
+    return (((size_t*)next_block(block))[-1] & 1) == bin_epoch;
+}
+
+static inline void set_unbinned_footer(block_header_t* block) {
+    ((size_t*)next_block(block))[-1] = block_size(block) | (bin_epoch ^ 1);
+}
+
+static inline void count_block(block_header_t* block) {
+    if (block->header & BLOCK_ALLOC) {
+        pass_stats.allocated_blocks++;
+        pass_stats.total_allocated += block_size(block);
+    } else {
+        pass_stats.free_blocks++;
+        pass_stats.total_freed += block_size(block);
+    }
+}
+
+static void publish_pass_stats(void) {
+    pass_stats.heap_start = heap_start;
+    pass_stats.heap_size = heap_size;
+    for (region_t* region = regions; region; region = region->next) {
+        pass_stats.heap_size += region->size;
+    }
+    stats_snapshot = pass_stats;
+    snapshot_valid = 1;
+}
+
+// Empties the bins and starts a pass from the first region.
+static void compact_start(void) {
+    memset(openalloc_free_lists, 0, sizeof(openalloc_free_lists));
+    bin_epoch ^= 1;
+    compact_cursor = first_block;
+    compact_next_region = regions;
+    memset(&pass_stats, 0, sizeof(pass_stats));
+}
+
+// Sliding compaction from the cursor: adjacent free blocks the pass has
+// not reached are merged, and an unlocked handle block right after one is
+// moved down into it, carrying the free space up to meet the next. A free
+// block is binned once the pass leaves it behind. With move clear this
+// just bins the rest of the pass. Stops at deadline or the end of the pass.
+static void compact_run(uint64_t deadline, int move) {
+    block_header_t* block = compact_cursor;
+    unsigned steps = 0;
+    
+    while (block) {
+        if ((++steps & 63) == 0 && now_us() >= deadline) break;
+        if (block_size(block) == 0) {
+            region_t* region = compact_next_region;
+            block = region ? (block_header_t*)(region + 1) : NULL;
+            if (region) compact_next_region = region->next;
+            continue;
+        }
+        
+        block_header_t* next = next_block(block);
+        if ((block->header & BLOCK_ALLOC) || block == top || in_bin(block)) {
+            count_block(block);
+            block = next;
+            continue;
+        }
+        if (next == top) {
+            merge_top(block, &top);
+            continue;
+        }
+        if (!(next->header & BLOCK_ALLOC) && !in_bin(next)) {
+            block->header += HEADER_SIZE + block_size(next);
+            set_unbinned_footer(block);
+            continue;
+        }
+        
+        handle_slot_t* slot = move && (next->header & BLOCK_ALLOC) && block_size(next) ? block_handle(next) : NULL;
+        if (!slot || slot->locks) {
+            count_block(block);
+            push_free(block);
+            block = next;
+            continue;
+        }
+        
+        size_t free_size = block_size(block);
+        size_t live_size = block_size(next);
+        memmove(get_data(block), get_data(next), live_size);
+        init_block(block, live_size | BLOCK_ALLOC | (block->header & BLOCK_PREV_ALLOC));
+        slot->block = block;
+        count_block(block);
+        block = next_block(block);
+        init_block(block, free_size | BLOCK_PREV_ALLOC);
+        next_block(block)->header &= ~BLOCK_PREV_ALLOC;
+        set_unbinned_footer(block);
+    }
+    compact_cursor = block;
+    if (!block) publish_pass_stats();
+}
+
+int openalloc_compact(unsigned budget_us) {
+    if (heap_lock_needed()) {
+        heap_lock();
+        int ret = openalloc_compact(budget_us);
+        heap_unlock();
+        return ret;
+    }
+    if (!first_block || numa_nodes || shared_unlocked || lifetime_heaps) return 0;
+    openalloc_flush();
+    
+    if (!compact_cursor) compact_start();
+    compact_run(budget_us ? now_us() + budget_us : UINT64_MAX, 1);
+    return compact_cursor != NULL;
+}
+
+// Background maintenance. The thread wakes every background_interval ms
+// and runs one pass in slices of at most BACKGROUND_SLICE_US with the heap
+// lock held, letting the foreground in between slices. A pass flushes the
+// deferred queue, runs a compaction pass that only merges (no blocks move),
+// which also rebins every free block in address order and refreshes the
+// stats snapshot, and then purges: a large free block that was already
+// free at the previous pass has the pages inside it returned with
+// MADV_DONTNEED. Its second payload word records the pass that saw it.
+#define BACKGROUND_SLICE_US 500
+#define PURGE_MIN ((size_t)64 << 10)
+static pthread_t background_thread;
+static pthread_cond_t background_wake;
+static pthread_once_t background_once = PTHREAD_ONCE_INIT;
+static unsigned background_interval = 0;
+static int background_stop = 0;
+static int background_merged = 0;
+static uint64_t purge_pass = 0;
+static block_header_t* purge_top = NULL;
+static size_t purge_top_size = 0;
+
+static inline uint64_t purge_mark(uint64_t pass) {
+    return (pass * 0x9E3779B97F4A7C15ull) & ~(uint64_t)1;
+}
+
+// Returns the whole pages inside [start, end) to the OS.
+static void purge_range(uint8_t* start, uint8_t* end) {
+    uint8_t* from = (uint8_t*)(((uintptr_t)start + page_size - 1) & ~(uintptr_t)(page_size - 1));
+    uint8_t* to = (uint8_t*)((uintptr_t)end & ~(uintptr_t)(page_size - 1));
+    if (from < to) madvise(from, (size_t)(to - from), MADV_DONTNEED);
+}
+
+// Large blocks all sit in the last bin. The low bit of a mark says the
+// block was purged then, so it is not purged again while it stays free.
+static void purge_idle(uint64_t deadline) {
+    if (!page_size) page_size = (size_t)sysconf(_SC_PAGESIZE);
+    uint64_t seen = purge_mark(purge_pass);
+    uint64_t mark = purge_mark(++purge_pass);
+    unsigned steps = 0;
+    for (block_header_t* block = openalloc_free_lists[NUM_BINS - 1]; block; block = get_next(block)) {
+        if ((++steps & 63) == 0 && now_us() >= deadline) break;
+        if (block_size(block) < PURGE_MIN) continue;
+        uint64_t* word = (uint64_t*)get_data(block) + 1;
+        if (*word == seen) {
+            purge_range((uint8_t*)(word + 1), (uint8_t*)next_block(block) - sizeof(size_t));
+        }
+        *word = *word == seen || *word == (seen | 1) ? mark | 1 : mark;
+    }
+    
+    // The top has no footer and moves with every block cut from it, so it
+    // is idle if it has not changed since the previous pass.
+    if (top && top == purge_top && block_size(top) == purge_top_size) {
+        purge_range((uint8_t*)get_data(top), (uint8_t*)next_block(top));
+        purge_top_size = 0;
+    } else if (top != purge_top || purge_top_size != 0) {
+        purge_top = top;
+        purge_top_size = top ? block_size(top) : 0;
+    }
+}
+
+// One slice of a maintenance pass; returns 1 while the pass has more to do.
+static int background_slice(uint64_t deadline) {
+    if (!first_block) return 0;
+    openalloc_flush();
+    if (!background_merged) {
+        // NUMA and lifetime heaps have bins of their own the pass does not
+        // know about.
+        if (!numa_nodes && !lifetime_heaps) {
+            if (!compact_cursor) compact_start();
+            compact_run(deadline, 0);
+            if (compact_cursor) return 1;
+        }
+        background_merged = 1;
+        if (now_us() >= deadline) return 1;
+    }
+    purge_idle(deadline);
+    background_merged = 0;
+    return 0;
+}
+
+static void* background_main(void* arg) {
+    (void)arg;
+    heap_lock();
+    while (!background_stop) {
+        struct timespec wake;
+        clock_gettime(CLOCK_MONOTONIC, &wake);
+        wake.tv_sec += background_interval / 1000;
+        wake.tv_nsec += (long)(background_interval % 1000) * 1000000;
+        if (wake.tv_nsec >= 1000000000) {
+            wake.tv_sec++;
+            wake.tv_nsec -= 1000000000;
+        }
+        while (!background_stop &&
+               pthread_cond_timedwait(&background_wake, &background_mutex, &wake) == 0) {
+        }
+        
+        while (!background_stop && background_slice(now_us() + BACKGROUND_SLICE_US)) {
+            heap_unlock();
+            sched_yield();
+            heap_lock();
+        }
+    }
+    heap_unlock();
+    return NULL;
+}
+
+// A forked child has no background thread, and the lock may have been
+// taken mid-slice.
+static void background_fork_prepare(void) {
+    if (openalloc_background) pthread_mutex_lock(&background_mutex);
+}
+
+static void background_fork_parent(void) {
+    if (openalloc_background) pthread_mutex_unlock(&background_mutex);
+}
+
+static void background_fork_child(void) {
+    pthread_mutex_init(&background_mutex, NULL);
+    heap_lock_held = 0;
+    openalloc_background = 0;
+}
+
+static void background_setup(void) {
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&background_wake, &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_atfork(background_fork_prepare, background_fork_parent, background_fork_child);
+}
+
+int openalloc_start_background(unsigned interval_ms) {
+    // A shared heap's bins are only ours while its lock is held.
+    if (interval_ms == 0 || !first_block || shared_unlocked) return -1;
+    pthread_once(&background_once, background_setup);
+    if (openalloc_background) {
+        heap_lock();
+        background_interval = interval_ms;
+        heap_unlock();
+        return 0;
+    }
+    
+    background_interval = interval_ms;
+    background_stop = 0;
+    background_merged = 0;
+    openalloc_background = 1;
+    if (pthread_create(&background_thread, NULL, background_main, NULL) != 0) {
+        openalloc_background = 0;
+        return -1;
+    }
+    return 0;
+}
+
+void openalloc_stop_background(void) {
+    if (!openalloc_background) return;
+    pthread_mutex_lock(&background_mutex);
+    background_stop = 1;
+    pthread_cond_signal(&background_wake);
+    pthread_mutex_unlock(&background_mutex);
+    pthread_join(background_thread, NULL);
+    openalloc_background = 0;
+}
+
+int openalloc_get_stats_snapshot(openalloc_stats_t* stats) {
+    if (!stats) return -1;
+    if (heap_lock_needed()) {
+        heap_lock();
+        int ret = openalloc_get_stats_snapshot(stats);
+        heap_unlock();
+        return ret;
+    }
+    if (!snapshot_valid) return -1;
+    *stats = stats_snapshot;
+    return 0;
+}
+
+// Every pass ends with a purge, so the purge count is the pass count.
+uint64_t openalloc_background_passes(void) {
+    if (heap_lock_needed()) {
+        heap_lock();
+        uint64_t passes = openalloc_background_passes();
+        heap_unlock();
+        return passes;
+    }
+    return purge_pass;
+}
+
+#ifdef OPENALLOC_DEBUG
+static void debug_check_free(void* ptr) {
+    block_header_t* block = get_block(ptr);
+    DEBUG_CHECK(valid_block(block), "free of a pointer not from this heap, or header clobbered", ptr);
+    DEBUG_CHECK(block->header & BLOCK_ALLOC, "double free", ptr);
+    for (int i = 0; i < deferred_count; i++) {
+        DEBUG_CHECK(deferred[i] != block, "double free", ptr);
+    }
+    DEBUG_CHECK(canary_ok(next_block(block)), "write past the end of a block", ptr);
+}
+#endif
+
+void openalloc_free(void* ptr) {
+    if (UNLIKELY(!ptr)) return;
+    if (heap_lock_needed()) {
+        heap_lock();
+        openalloc_free(ptr);
+        heap_unlock();
+        return;
+    }
+    if (UNLIKELY(shared_unlocked)) {
+        shared_enter();
+        openalloc_free(ptr);
+        shared_leave();
+        return;
+    }
+    
+    int node = 0;
+    if (slabs_live || numa_nodes || lifetime_heaps) {
+        uintptr_t entry = pagemap_get(ptr);
+        if (entry & PAGEMAP_SLAB_MASK) {
+            if ((entry & PAGEMAP_BIN_MASK) == PAGEMAP_BUMP) {
+                openalloc_used -= block_size(get_block(ptr));
+                bump_free(entry, ptr);
+            } else {
+                openalloc_used -= openalloc_class_sizes[entry & PAGEMAP_BIN_MASK];
+                slab_free(entry, ptr);
+            }
+            return;
+        }
+        node = PAGEMAP_NODE(entry);
+    }
+    
+    openalloc_used -= block_size(get_block(ptr));
+    if (UNLIKELY(get_block(ptr)->header & BLOCK_GUARDED)) {
+        guarded_free(get_block(ptr));
+        return;
+    }
+    
+#ifdef OPENALLOC_DEBUG
+    debug_check_free(ptr);
+#endif
+    
+    // The deferred queue only holds blocks of the main heap.
+    if (UNLIKELY(node != active_node)) {
+        if (node >= TAG_NODE(1) && !numa_nodes) {
+            tag_stats[NODE_TAG(node)].live_bytes -= block_size(get_block(ptr));
+            tag_stats[NODE_TAG(node)].live_blocks--;
+        }
+        push_free_node(get_block(ptr), node);
+        return;
+    }
+    
+    if (UNLIKELY(deferred_enabled)) {
+        deferred[deferred_count++] = get_block(ptr);
+        if (deferred_count == DEFER_CAPACITY) openalloc_flush();
+        return;
+    }
+    push_free(get_block(ptr));
+}
+
+int openalloc_set_deferred_free(int enable) {
+    if (heap_lock_needed()) {
+        heap_lock();
+        int ret = openalloc_set_deferred_free(enable);
+        heap_unlock();
+        return ret;
+    }
+    // The flush merges into the running node's bins only, and a shared
+    // heap's bins are only ours while its lock is held.
+    if (enable && (numa_nodes || shared_unlocked)) return -1;
+    if (!enable) openalloc_flush();
+    deferred_enabled = enable != 0;
+    return 0;
+}
+
+void openalloc_flush(void) {
+    if (heap_lock_needed()) {
+        heap_lock();
+        openalloc_flush();
+        heap_unlock();
+        return;
+    }
+    int count = deferred_count;
+    if (count == 0) return;
+    deferred_count = 0;
+    
+    block_header_t* heads[NUM_BINS] = {NULL};
+    block_header_t* tails[NUM_BINS];
+    for (int i = 0; i < count;) {
+        if (i + DEFER_PREFETCH < count) __builtin_prefetch(deferred[i + DEFER_PREFETCH], 1);
+        block_header_t* block = deferred[i++];
+        
+        // Neighbours freed back to back, in either direction, are queued
+        // next to each other and come back as one block.
+        while (i < count) {
+            block_header_t* other = deferred[i];
+            if (other == next_block(block)) {
+                block->header += HEADER_SIZE + block_size(other);
+                if (UNLIKELY(other == compact_cursor)) compact_cursor = block;
+            } else if (next_block(other) == block) {
+                other->header += HEADER_SIZE + block_size(block);
+                if (UNLIKELY(block == compact_cursor)) compact_cursor = other;
+                block = other;
+            } else {
+                break;
+            }
+            i++;
+        }
+        
+        if (UNLIKELY(next_block(block) == top)) {
+            merge_top(block, &top);
+            continue;
+        }
+        int bin = release_block(block);
+        set_next(block, NULL);
+        if (heads[bin]) {
+            set_next(tails[bin], block);
+        } else {
+            heads[bin] = block;
+        }
+        tails[bin] = block;
+    }
+    
+    for (int bin = 0; bin < NUM_BINS; bin++) {
+        if (heads[bin]) {
+            set_next(tails[bin], openalloc_free_lists[bin]);
+            openalloc_free_lists[bin] = heads[bin];
+        }
+    }
+}
+
+static int heap_corrupt(const char* what, const void* ptr) {
+    fprintf(stderr, "openalloc: check_heap: %s (%p)\n", what, ptr);
+    return -1;
+}
+
+int openalloc_check_heap(void) {
+    if (!first_block) return 0;
+    if (heap_lock_needed()) {
+        heap_lock();
+        int ret = openalloc_check_heap();
+        heap_unlock();
+        return ret;
+    }
+    if (shared_unlocked) {
+        shared_enter();
+        int ret = openalloc_check_heap();
+        shared_leave();
+        return ret;
+    }
+    
+    size_t free_blocks = 0;
+    int tops = 0;
+    region_t primary = {regions, heap_size, 0, 0};
+    for (region_t* region = &primary; region; region = region->next) {
+        block_header_t* block = region == &primary ? first_block : (block_header_t*)(region + 1);
+        uint8_t* end = region == &primary ? (uint8_t*)heap_start + heap_size : (uint8_t*)region + region->size;
+        block_header_t* region_top = *node_top((int)region->node);
+        size_t prev_alloc = BLOCK_PREV_ALLOC;
+        
+        for (;;) {
+            if ((uint8_t*)block + HEADER_SIZE > end) return heap_corrupt("block runs past its region", block);
+            if (!canary_ok(block)) return heap_corrupt("header canary clobbered", block);
+            if ((block->header & BLOCK_PREV_ALLOC) != prev_alloc) return heap_corrupt("stale PREV_ALLOC bit", block);
+            if (block_size(block) == 0) break;
+            
+            if (block == region_top) {
+                if ((block->header & BLOCK_ALLOC) || block_size(next_block(block)) != 0) {
+                    return heap_corrupt("top is not a free block ending its region", block);
+                }
+                tops++;
+            } else if (!(block->header & BLOCK_ALLOC)) {
+                if ((((size_t*)next_block(block))[-1] & SIZE_MASK) != block_size(block)) {
+                    return heap_corrupt("free block footer does not match its size", block);
+                }
+                if (in_bin(block)) {
+                    free_blocks++;
+                } else if (!compact_cursor) {
+                    return heap_corrupt("free block missing from the bins", block);
+                }
+            }
+            prev_alloc = block->header & BLOCK_ALLOC ? BLOCK_PREV_ALLOC : 0;
+            block = next_block(block);
+        }
+        if (!(block->header & BLOCK_ALLOC)) return heap_corrupt("region fence clobbered", block);
+    }
+    
+    size_t listed = 0;
+    int nodes = numa_nodes ? numa_nodes : lifetime_heaps ? TAG_NODES : 1;
+    for (int node = 0; node < nodes; node++) {
+        if (*node_top(node) && tops-- == 0) return heap_corrupt("top outside the heap", *node_top(node));
+    }
+    for (int node = 0; node < nodes; node++) {
+        block_header_t** bins = node_bins(node);
+        for (int bin = 0; bin < NUM_BINS; bin++) {
+            for (block_header_t* block = bins[bin]; block; block = reveal_next(block)) {
+                if (++listed > free_blocks) return heap_corrupt("free list cycle or stray entry", block);
+                if (!valid_block(block)) return heap_corrupt("free list pointer outside the heap", block);
+                if (block->header & BLOCK_ALLOC) return heap_corrupt("allocated block on a free list", block);
+                if (get_bin(block_size(block)) != bin) return heap_corrupt("free block in the wrong bin", block);
+                if ((numa_nodes || lifetime_heaps) && PAGEMAP_NODE(pagemap_get(block)) != node) {
+                    return heap_corrupt("free block in another node's bins", block);
+                }
+            }
+        }
+    }
+    if (listed != free_blocks) return heap_corrupt("free block missing from the bins", NULL);
+    
+    for (int node = 0; node < nodes; node++) {
+        slab_t** slabs = node_slabs(node);
+        for (int bin = 0; bin < NUM_BINS; bin++) {
+            for (slab_t* slab = slabs[bin]; slab; slab = slab->next) {
+                uintptr_t entry = (uintptr_t)slab | (uintptr_t)node << PAGEMAP_NODE_SHIFT | (uintptr_t)bin;
+                if (pagemap_get(slab) != entry) return heap_corrupt("slab missing from the page map", slab);
+                
+                size_t free_objs = 0;
+                for (slab_obj_t* obj = slab->free; obj;
+                     obj = (slab_obj_t*)OPENALLOC_REVEAL(&obj->next, obj->next)) {
+                    if ((uint8_t*)obj < (uint8_t*)(slab + 1) || (uint8_t*)obj >= slab->bump ||
+                        ++free_objs > (size_t)(slab->bump - (uint8_t*)slab) / slab->obj_size) {
+                        return heap_corrupt("bad slab free list entry", obj);
+                    }
+                }
+            }
+        }
+    }
+    
+    return 0;
+}
+
+#endif
+
+void* openalloc_realloc(void* ptr, size_t new_size) {
+    if (heap_lock_needed()) {
+        heap_lock();
+        void* ret = openalloc_realloc(ptr, new_size);
+        heap_unlock();
+        return ret;
+    }
+    if (!ptr) return openalloc_malloc(new_size);
+    if (new_size == 0) {
+        openalloc_free(ptr);
+        return NULL;
+    }
+    
+#ifdef OPENALLOC_NO_SEG
+    block_header_doubly_t* block = get_block_doubly(ptr);
+    size_t old_size = block->size;
+#else
+    size_t old_size = openalloc_usable_size(ptr);
+#endif
+    
+    if (new_size <= old_size) {
+        return ptr;
     }
     
     void* new_ptr = openalloc_malloc(new_size);
@@ -313,24 +2849,39 @@ void* openalloc_realloc(void* ptr, size_t new_size) {
 
 size_t openalloc_usable_size(void* ptr) {
     if (!ptr) return 0;
+    if (heap_lock_needed()) {
+        heap_lock();
+        size_t ret = openalloc_usable_size(ptr);
+        heap_unlock();
+        return ret;
+    }
 #ifdef OPENALLOC_NO_SEG
     return get_block_doubly(ptr)->size;
 #else
-    return get_block(ptr)->size;
+    if (slabs_live || lifetime_heaps) {
+        uintptr_t entry = pagemap_get(ptr);
+        if ((entry & PAGEMAP_SLAB_MASK) && (entry & PAGEMAP_BIN_MASK) != PAGEMAP_BUMP) {
+            return openalloc_class_sizes[entry & PAGEMAP_BIN_MASK];
+        }
+    }
+    return block_size(get_block(ptr));
 #endif
 }
 
-void openalloc_get_stats(openalloc_stats_t* stats) {
-    if (!stats) return;
+// Totals over the regions of one node, or of the whole heap for node -1.
+static void collect_stats(openalloc_stats_t* stats, int node) {
+    openalloc_flush();
     
     stats->heap_start = heap_start;
-    stats->heap_size = heap_size;
+    stats->heap_size = 0;
     stats->allocated_blocks = 0;
     stats->free_blocks = 0;
     stats->total_allocated = 0;
     stats->total_freed = 0;
     
 #ifdef OPENALLOC_NO_SEG
+    (void)node;
+    stats->heap_size = heap_size;
     block_header_doubly_t* block = (block_header_doubly_t*)heap_start;
     size_t header_size = sizeof(block_header_doubly_t);
     while ((uint8_t*)block < (uint8_t*)heap_start + heap_size) {
@@ -344,17 +2895,306 @@ void openalloc_get_stats(openalloc_stats_t* stats) {
         block = (block_header_doubly_t*)((uint8_t*)block + header_size + block->size);
     }
 #else
-    block_header_t* block = (block_header_t*)heap_start;
-    size_t header_size = sizeof(block_header_t);
-    while ((uint8_t*)block < (uint8_t*)heap_start + heap_size) {
-        if (block->free) {
-            stats->free_blocks++;
-            stats->total_freed += block->size;
-        } else {
-            stats->allocated_blocks++;
-            stats->total_allocated += block->size;
+    if (!first_block) return;
+    if (shared_unlocked) {
+        shared_enter();
+        collect_stats(stats, node);
+        shared_leave();
+        return;
+    }
+    
+    // A lifetime chunk is counted through its own region, not as the
+    // allocated block holding it.
+    region_t primary = {regions, heap_size, 0, 0};
+    for (region_t* region = &primary; region; region = region->next) {
+        if (node >= 0 && numa_nodes && region->node != (size_t)node) continue;
+        block_header_t* block = region == &primary ? first_block : (block_header_t*)(region + 1);
+        int chunk = lifetime_heaps && region->node != 0;
+        if (!chunk) stats->heap_size += region->size;
+        
+        for (; block_size(block) != 0; block = next_block(block)) {
+            if (lifetime_heaps && !chunk && (block->header & BLOCK_ALLOC) &&
+                PAGEMAP_NODE(pagemap_get(get_data(block))) != 0) {
+                continue;
+            }
+            if (!(block->header & BLOCK_ALLOC)) {
+                stats->free_blocks++;
+                stats->total_freed += block_size(block);
+            } else {
+                stats->allocated_blocks++;
+                stats->total_allocated += block_size(block);
+            }
+        }
+    }
+#endif
+}
+
+void openalloc_get_stats(openalloc_stats_t* stats) {
+    if (heap_lock_needed()) {
+        heap_lock();
+        openalloc_get_stats(stats);
+        heap_unlock();
+        return;
+    }
+    if (!stats) return;
+    collect_stats(stats, -1);
+}
+
+int openalloc_get_node_stats(int node, openalloc_stats_t* stats) {
+    if (heap_lock_needed()) {
+        heap_lock();
+        int ret = openalloc_get_node_stats(node, stats);
+        heap_unlock();
+        return ret;
+    }
+#ifdef OPENALLOC_NO_SEG
+    int nodes = 1;
+#else
+    int nodes = numa_nodes ? numa_nodes : 1;
+#endif
+    if (!stats || node < 0 || node >= nodes) return -1;
+    collect_stats(stats, node);
+    return 0;
+}
+
+// Epoch-based reclamation. Each thread that takes part claims a record,
+// cache-line sized so that entering and leaving touch no shared line but
+// its own. A record's state is the global epoch it entered in, shifted
+// left, with bit 0 set while it is inside a critical section. The global
+// epoch moves on once every active record has seen it, so a block retired
+// in epoch e cannot be reachable by anyone after the epoch reaches e + 2.
+// Retired blocks wait in page-sized limbo bags mapped outside the heap,
+// since readers may still be looking at their contents and the heap may be
+// out of memory; emptied bags are kept by their record for reuse.
+#define EPOCH_MAX_THREADS 256
+#define LIMBO_BAG_SIZE 509
+
+typedef struct limbo_bag {
+    struct limbo_bag* next;    // older bags
+    uint64_t epoch;            // of the newest block in it
+    size_t count;
+    void* ptrs[LIMBO_BAG_SIZE];
+} limbo_bag_t;
+
+typedef struct {
+    uint64_t state;
+    int claimed;
+    unsigned depth;            // nesting of openalloc_epoch_enter
+    unsigned generation;       // heap_generation the limbo belongs to
+    limbo_bag_t* limbo;        // newest bag first
+    limbo_bag_t* spare;
+    size_t pending;
+} __attribute__((aligned(64))) epoch_record_t;
+
+static epoch_record_t epoch_records[EPOCH_MAX_THREADS];
+static int epoch_record_count = 0;
+static uint64_t global_epoch = 0;
+static __thread epoch_record_t* epoch_self;
+static pthread_key_t epoch_key;
+static pthread_once_t epoch_once = PTHREAD_ONCE_INIT;
+
+// Thread exit leaves the record, limbo and all, to the next thread that
+// claims it.
+static void epoch_release(void* arg) {
+    epoch_record_t* rec = arg;
+    rec->depth = 0;
+    __atomic_store_n(&rec->state, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&rec->claimed, 0, __ATOMIC_RELEASE);
+}
+
+static void epoch_key_create(void) {
+    pthread_key_create(&epoch_key, epoch_release);
+}
+
+static epoch_record_t* epoch_record(void) {
+    if (LIKELY(epoch_self != NULL)) return epoch_self;
+    pthread_once(&epoch_once, epoch_key_create);
+    for (int i = 0; i < EPOCH_MAX_THREADS; i++) {
+        int unclaimed = 0;
+        if (__atomic_compare_exchange_n(&epoch_records[i].claimed, &unclaimed, 1, 0,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            int count = __atomic_load_n(&epoch_record_count, __ATOMIC_RELAXED);
+            while (count <= i && !__atomic_compare_exchange_n(&epoch_record_count, &count, i + 1, 0,
+                                                              __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+            }
+            epoch_self = &epoch_records[i];
+            pthread_setspecific(epoch_key, epoch_self);
+            return epoch_self;
+        }
+    }
+    return NULL;
+}
+
+// Moves the global epoch on by one if every active record has seen it.
+static int epoch_try_advance(void) {
+    uint64_t epoch = __atomic_load_n(&global_epoch, __ATOMIC_SEQ_CST);
+    int count = __atomic_load_n(&epoch_record_count, __ATOMIC_ACQUIRE);
+    for (int i = 0; i < count; i++) {
+        uint64_t state = __atomic_load_n(&epoch_records[i].state, __ATOMIC_SEQ_CST);
+        if ((state & 1) && (state >> 1) != epoch) return 0;
+    }
+    // Losing the race means another thread moved it on.
+    __atomic_compare_exchange_n(&global_epoch, &epoch, epoch + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+    return 1;
+}
+
+// Frees the blocks of a chain of bags, through the deferred queue where it
+// can be used so that the whole batch reaches the bins as one chain per
+// bin, and keeps the bags as spares.
+static void free_bags(epoch_record_t* rec, limbo_bag_t* bag) {
+#ifndef OPENALLOC_NO_SEG
+    int queue = !deferred_enabled && !numa_nodes && !shared_unlocked;
+    if (queue) deferred_enabled = 1;
+#endif
+    while (bag) {
+        limbo_bag_t* next = bag->next;
+        for (size_t i = 0; i < bag->count; i++) {
+            openalloc_free(bag->ptrs[i]);
         }
-        block = (block_header_t*)((uint8_t*)block + header_size + block->size);
+        rec->pending -= bag->count;
+        bag->next = rec->spare;
+        rec->spare = bag;
+        bag = next;
+    }
+#ifndef OPENALLOC_NO_SEG
+    if (queue) {
+        deferred_enabled = 0;
+        openalloc_flush();
     }
 #endif
 }
+
+// A heap reinitialized since the record last retired took the blocks in
+// its limbo with it.
+static void epoch_check_generation(epoch_record_t* rec) {
+    if (UNLIKELY(rec->generation != heap_generation)) {
+        rec->generation = heap_generation;
+        while (rec->limbo) {
+            limbo_bag_t* bag = rec->limbo;
+            rec->limbo = bag->next;
+            bag->next = rec->spare;
+            rec->spare = bag;
+        }
+        rec->pending = 0;
+    }
+}
+
+// Frees the bags of rec that no reader can still reach.
+static void reclaim_bags(epoch_record_t* rec, uint64_t epoch) {
+    epoch_check_generation(rec);
+    limbo_bag_t** link = &rec->limbo;
+    while (*link && (*link)->epoch + 2 > epoch) {
+        link = &(*link)->next;
+    }
+    limbo_bag_t* safe = *link;
+    *link = NULL;
+    free_bags(rec, safe);
+}
+
+// Reclaims what it can from rec, after trying to move the epoch on far
+// enough for all of it, and from the limbo that exited threads left in
+// records nobody has claimed since. Returns the blocks left in rec.
+static size_t epoch_reclaim(epoch_record_t* rec) {
+    for (int i = 0; i < 2 && epoch_try_advance(); i++) {
+    }
+    uint64_t epoch = __atomic_load_n(&global_epoch, __ATOMIC_ACQUIRE);
+    reclaim_bags(rec, epoch);
+    
+    int count = __atomic_load_n(&epoch_record_count, __ATOMIC_ACQUIRE);
+    for (int i = 0; i < count; i++) {
+        epoch_record_t* orphan = &epoch_records[i];
+        int unclaimed = 0;
+        if (__atomic_load_n(&orphan->claimed, __ATOMIC_RELAXED) == 0 &&
+            __atomic_compare_exchange_n(&orphan->claimed, &unclaimed, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            if (orphan->limbo) reclaim_bags(orphan, epoch);
+            __atomic_store_n(&orphan->claimed, 0, __ATOMIC_RELEASE);
+        }
+    }
+    return rec->pending;
+}
+
+static limbo_bag_t* new_limbo_bag(epoch_record_t* rec) {
+    limbo_bag_t* bag = rec->spare;
+    if (bag) {
+        rec->spare = bag->next;
+    } else {
+        bag = mmap(NULL, sizeof(limbo_bag_t), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (bag == MAP_FAILED) return NULL;
+    }
+    bag->next = rec->limbo;
+    bag->count = 0;
+    rec->limbo = bag;
+    return bag;
+}
+
+int openalloc_epoch_enter(void) {
+    epoch_record_t* rec = epoch_record();
+    if (UNLIKELY(!rec)) return -1;
+    if (rec->depth++ == 0) {
+        uint64_t epoch = __atomic_load_n(&global_epoch, __ATOMIC_RELAXED);
+        __atomic_store_n(&rec->state, epoch << 1 | 1, __ATOMIC_RELAXED);
+        // The state must be visible before any read of the structure.
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    }
+    return 0;
+}
+
+void openalloc_epoch_exit(void) {
+    epoch_record_t* rec = epoch_self;
+    if (rec && rec->depth && --rec->depth == 0) {
+        __atomic_store_n(&rec->state, 0, __ATOMIC_RELEASE);
+    }
+}
+
+int openalloc_retire(void* ptr) {
+    if (!ptr) return 0;
+    if (heap_lock_needed()) {
+        heap_lock();
+        int ret = openalloc_retire(ptr);
+        heap_unlock();
+        return ret;
+    }
+    epoch_record_t* rec = epoch_record();
+    
+    // The block was unlinked before this; the epoch read must not move
+    // above that.
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    uint64_t epoch = __atomic_load_n(&global_epoch, __ATOMIC_RELAXED);
+    
+    limbo_bag_t* bag = NULL;
+    if (LIKELY(rec != NULL)) {
+        epoch_check_generation(rec);
+        bag = rec->limbo;
+        if (!bag || bag->count == LIMBO_BAG_SIZE) bag = new_limbo_bag(rec);
+    }
+    
+    // Without a record or a bag, wait out two epochs and free it now. That
+    // cannot end inside the caller's own critical section, so there the
+    // block stays the caller's. Readers may still see it, so it cannot be
+    // chained through its own payload either.
+    if (UNLIKELY(!bag)) {
+        if (rec && rec->depth) return -1;
+        while (__atomic_load_n(&global_epoch, __ATOMIC_ACQUIRE) < epoch + 2) {
+            if (!epoch_try_advance()) sched_yield();
+        }
+        openalloc_free(ptr);
+        return 0;
+    }
+    
+    bag->ptrs[bag->count++] = ptr;
+    bag->epoch = epoch;
+    rec->pending++;
+    if (bag->count == LIMBO_BAG_SIZE) epoch_reclaim(rec);
+    return 0;
+}
+
+size_t openalloc_epoch_reclaim(void) {
+    if (heap_lock_needed()) {
+        heap_lock();
+        size_t ret = openalloc_epoch_reclaim();
+        heap_unlock();
+        return ret;
+    }
+    epoch_record_t* rec = epoch_record();
+    return rec ? epoch_reclaim(rec) : 0;
+}
@@ -18,12 +18,177 @@ typedef struct {
 } openalloc_stats_t;
 
 int openalloc_init(void* heap_start, size_t heap_size);
+int openalloc_init_growable(size_t segment_size);
+int openalloc_add_region(void* region, size_t size);
 void* openalloc_malloc(size_t size);
+void* openalloc_memalign(size_t alignment, size_t size);
 void openalloc_free(void* ptr);
 void* openalloc_realloc(void* ptr, size_t new_size);
 size_t openalloc_usable_size(void* ptr);
 void openalloc_get_stats(openalloc_stats_t* stats);
 
+// Deferred free mode: openalloc_free() queues blocks and returns them to the
+// bins in batches. openalloc_flush() drains the queue.
+int openalloc_set_deferred_free(int enable);
+void openalloc_flush(void);
+
+// Guard-page sampling: about one in `rate` openalloc_malloc calls is placed
+// on its own pages, right against a PROT_NONE guard page, and quarantined
+// inaccessible after free. 0 turns sampling off.
+int openalloc_set_guard_sample_rate(size_t rate);
+
+// Serves requests up to max_size (rounded up to its size class) from
+// header-free slabs of one size class each. 0 turns slabs off.
+int openalloc_set_slab_max(size_t max_size);
+
+// NUMA heaps for a growable heap: each node gets its own bins and grows
+// from segments placed on that node; malloc serves the calling thread's
+// node and free returns memory to the node that owns it. Stays on until
+// the next openalloc_init. openalloc_get_node_stats returns -1 past the
+// last node.
+int openalloc_set_numa(int enable);
+int openalloc_get_node_stats(int node, openalloc_stats_t* stats);
+
+// Huge pages: later segments are 2 MiB aligned and backed by hugetlbfs
+// pages where reserved, transparent huge pages otherwise; memory the heap
+// already has is advised MADV_HUGEPAGE. Slabs are packed into 2 MiB arenas.
+int openalloc_set_huge_pages(int enable);
+
+// Lifetime hints: openalloc_malloc_hint keeps each lifetime class in 64 KiB
+// chunks of the main heap, so short-lived churn leaves no holes between
+// long-lived data. Short-lived blocks are bumped and a chunk is recycled
+// whole once they are all freed; long-lived and permanent ones have bins of
+// their own. Free them with openalloc_free. Without a valid hint, and on
+// NUMA, persistent and shared heaps, it is openalloc_malloc. Compaction is
+// off once hinted blocks exist.
+#define OPENALLOC_HINT_SHORT 1
+#define OPENALLOC_HINT_LONG 2
+#define OPENALLOC_HINT_PERMANENT 3
+void* openalloc_malloc_hint(size_t size, int hint);
+
+// Warm-up before taking traffic. openalloc_reserve carves count blocks
+// that fit size exactly and puts them on its bin (sizes served by slabs
+// fill slabs instead, of which each class keeps one when empty); -1 if
+// the heap ran out first, with the blocks carved so far still reserved.
+// openalloc_prefault faults in every page the heap has, and the segments
+// a growable heap maps from then on as it grows; a persistent heap's file
+// is read ahead instead.
+int openalloc_reserve(size_t size, size_t count);
+int openalloc_prefault(void);
+
+// Heap limits. openalloc_in_use is the bytes in live allocations, as
+// openalloc_usable_size counts them, kept up to date by malloc and free.
+// Past the soft limit allocations still succeed; a request that would
+// take usage past the hard limit returns NULL (0 for either: no limit).
+// The pressure callback runs when a request crosses the soft limit from
+// below, and before a request fails at the hard limit, so the caller can
+// free cached data first; the request is retried once it returns. -1 for
+// soft > hard, without a heap, or on a shared heap. openalloc_init and the
+// other heap initializers clear the limits and the callback.
+#define OPENALLOC_PRESSURE_SOFT 1
+#define OPENALLOC_PRESSURE_HARD 2
+typedef void (*openalloc_pressure_fn)(int level, size_t in_use, size_t request, void* arg);
+int openalloc_set_limits(size_t soft, size_t hard);
+void openalloc_set_pressure_callback(openalloc_pressure_fn fn, void* arg);
+size_t openalloc_in_use(void);
+
+// Allocation tags attribute live memory to subsystems. openalloc_set_tag
+// sets the calling thread's tag (0: untagged) and returns the previous
+// one, -1 for a tag out of range; openalloc_malloc and everything built
+// on it then allocate under that tag, and openalloc_malloc_tagged under
+// the one it is given. Each tag's blocks come from 64 KiB chunks of its
+// own, so free attributes them through the page map and blocks carry no
+// tag. openalloc_get_tag_stats reports a tag's live bytes and blocks and
+// the chunk bytes it holds; -1 for tag 0, whose usage is
+// openalloc_in_use() less every tag's live bytes. Tagged blocks skip the
+// slabs; memalign, hinted and handle allocations are untagged, and so is
+// everything on NUMA, persistent and shared heaps. Compaction is off once
+// tagged blocks exist.
+#define OPENALLOC_MAX_TAGS 32
+typedef struct {
+    size_t live_bytes;
+    size_t live_blocks;
+    size_t heap_bytes;
+} openalloc_tag_stats_t;
+int openalloc_set_tag(int tag);
+void* openalloc_malloc_tagged(size_t size, int tag);
+int openalloc_get_tag_stats(int tag, openalloc_tag_stats_t* stats);
+
+// Persistent heap in a caller-mapped file (MAP_SHARED). Free-list links are
+// stored as offsets, so the file can be mapped at a different address by
+// the next process. openalloc_attach returns 0 after a clean
+// openalloc_detach, 1 if it had to rebuild the free lists after a crash,
+// and -1 if the mapping holds no usable heap. The root slot names one
+// object to find the rest from; pointers the application stores inside
+// the heap must be offsets too.
+int openalloc_init_persistent(void* base, size_t size);
+int openalloc_attach(void* base, size_t size);
+int openalloc_detach(void);
+int openalloc_set_root(void* ptr);
+void* openalloc_get_root(void);
+
+// Shared heap: a persistent heap that several processes map (shm_open or
+// memfd_create plus MAP_SHARED) and use at once, serialized by a
+// process-shared futex lock in the file header. One process creates it
+// with openalloc_init_shared, the others join with
+// openalloc_attach_shared; openalloc_detach leaves it. Objects are handed
+// between processes as offsets, which the mapping address of each process
+// turns back into pointers.
+int openalloc_init_shared(void* base, size_t size);
+int openalloc_attach_shared(void* base, size_t size);
+size_t openalloc_ptr_to_offset(const void* ptr);   // 0 outside the heap file
+void* openalloc_offset_to_ptr(size_t offset);      // NULL outside the heap file
+
+// Movable allocations: openalloc_halloc returns a handle (0 on failure)
+// rather than an address. openalloc_hlock gives the current address and
+// pins the block until the matching openalloc_hunlock; unlocked blocks
+// may be moved by openalloc_compact, which slides them together so the
+// free space between them merges. Each call continues the current pass
+// over the heap for about budget_us microseconds (0: to its end) and
+// returns 1 while the pass is unfinished, 0 once it is complete.
+typedef uint32_t openalloc_handle_t;
+openalloc_handle_t openalloc_halloc(size_t size);
+void* openalloc_hlock(openalloc_handle_t handle);
+void openalloc_hunlock(openalloc_handle_t handle);
+void openalloc_hfree(openalloc_handle_t handle);
+int openalloc_compact(unsigned budget_us);
+
+// Background maintenance: openalloc_start_background starts a thread that
+// every interval_ms flushes the deferred queue, merges adjacent free blocks
+// and rebins them in address order, returns the pages of large blocks that
+// stayed free since its last pass with MADV_DONTNEED, and refreshes the
+// snapshot openalloc_get_stats_snapshot copies (-1 before the first pass).
+// openalloc_background_passes counts the passes finished so far; a pass
+// that starts after some change has seen it once the count moves by two.
+// It holds the heap for at most about half a millisecond at a time, and
+// while it runs every entry point takes a heap lock. Calling it again
+// changes the interval. Initializing, attaching or detaching a heap stops
+// it; shared heaps refuse it.
+int openalloc_start_background(unsigned interval_ms);
+void openalloc_stop_background(void);
+int openalloc_get_stats_snapshot(openalloc_stats_t* stats);
+uint64_t openalloc_background_passes(void);
+
+// Epoch-based reclamation for lock-free structures. Readers bracket their
+// accesses with openalloc_epoch_enter/exit, which take no lock and nest;
+// enter returns -1 once 256 threads hold records. openalloc_retire(ptr)
+// frees ptr once every thread that was inside a critical section when it
+// was retired has left it. Retired blocks wait in the calling thread's
+// limbo and are freed in batches; openalloc_epoch_reclaim frees those that
+// are safe now and returns how many remain. retire returns -1, leaving
+// ptr to the caller, if it is called inside a critical section and no
+// limbo bag can be mapped; retiring it again after openalloc_epoch_exit
+// cannot fail. retire and reclaim are heap calls like openalloc_free and
+// are serialized the same way.
+int openalloc_epoch_enter(void);
+void openalloc_epoch_exit(void);
+int openalloc_retire(void* ptr);
+size_t openalloc_epoch_reclaim(void);
+
+// Walks every block and bin and checks their invariants. Returns 0 if the
+// heap is consistent, -1 (with a message on stderr) otherwise.
+int openalloc_check_heap(void);
+
 #define OPENALLOC_ALIGN 8
 #define OPENALLOC_MIN_BLOCK (sizeof(size_t) * 2)
 
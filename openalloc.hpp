@@ -0,0 +1,105 @@
+#ifndef OPENALLOC_HPP
+#define OPENALLOC_HPP
+
+/*
+ * Header-only C++ glue for OpenAlloc.
+ *
+ *   openalloc::allocator<T>        stateless STL allocator
+ *   openalloc::memory_resource     std::pmr resource with alignment support
+ *   openalloc::monotonic_resource  arena: bump allocation, release() frees all
+ *   openalloc::pool_resource       size-bucketed pools refilled from the heap
+ *
+ * Like the C API these are not thread-safe; the heap must already be set up
+ * with openalloc_init() or openalloc_init_growable().
+ */
+
+#include "openalloc.h"
+#include <cstddef>
+#include <limits>
+#include <memory_resource>
+#include <new>
+
+namespace openalloc {
+
+inline void* allocate_bytes(std::size_t bytes, std::size_t alignment) {
+    if (bytes == 0) bytes = 1;
+    void* ptr = alignment <= OPENALLOC_ALIGN ? openalloc_malloc(bytes)
+                                             : openalloc_memalign(alignment, bytes);
+    if (!ptr) throw std::bad_alloc();
+    return ptr;
+}
+
+template <typename T>
+class allocator {
+public:
+    using value_type = T;
+    using size_type = std::size_t;
+    using difference_type = std::ptrdiff_t;
+    using propagate_on_container_move_assignment = std::true_type;
+    using is_always_equal = std::true_type;
+
+    allocator() noexcept = default;
+
+    template <typename U>
+    allocator(const allocator<U>&) noexcept {}
+
+    T* allocate(std::size_t n) {
+        if (n > std::numeric_limits<std::size_t>::max() / sizeof(T)) {
+            throw std::bad_array_new_length();
+        }
+        return static_cast<T*>(allocate_bytes(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T* ptr, std::size_t) noexcept {
+        openalloc_free(ptr);
+    }
+};
+
+template <typename T, typename U>
+bool operator==(const allocator<T>&, const allocator<U>&) noexcept { return true; }
+
+template <typename T, typename U>
+bool operator!=(const allocator<T>&, const allocator<U>&) noexcept { return false; }
+
+class memory_resource : public std::pmr::memory_resource {
+protected:
+    void* do_allocate(std::size_t bytes, std::size_t alignment) override {
+        return allocate_bytes(bytes, alignment);
+    }
+
+    void do_deallocate(void* ptr, std::size_t, std::size_t) override {
+        openalloc_free(ptr);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+        return dynamic_cast<const memory_resource*>(&other) != nullptr;
+    }
+};
+
+// Shared stateless resource, usable as the upstream of any pmr resource.
+inline memory_resource* get_memory_resource() noexcept {
+    static memory_resource resource;
+    return &resource;
+}
+
+class monotonic_resource : public std::pmr::monotonic_buffer_resource {
+public:
+    monotonic_resource()
+        : std::pmr::monotonic_buffer_resource(get_memory_resource()) {}
+
+    explicit monotonic_resource(std::size_t initial_size)
+        : std::pmr::monotonic_buffer_resource(initial_size, get_memory_resource()) {}
+};
+
+class pool_resource : public std::pmr::unsynchronized_pool_resource {
+public:
+    pool_resource()
+        : std::pmr::unsynchronized_pool_resource(get_memory_resource()) {}
+
+    explicit pool_resource(const std::pmr::pool_options& options)
+        : std::pmr::unsynchronized_pool_resource(options, get_memory_resource()) {}
+};
+
+}  // namespace openalloc
+
+#endif
@@ -0,0 +1,31 @@
+/* Generated by size-class-gen from defaults; do not edit by hand. */
+
+#ifndef OPENALLOC_CLASSES_H
+#define OPENALLOC_CLASSES_H
+
+#include <stdint.h>
+
+#define OPENALLOC_NUM_BINS 10
+#define OPENALLOC_CLASS_MAX 4096
+#define OPENALLOC_CLASS_LOOKUP_MAX 1024
+
+/* Upper bound of each bounded bin; the last bin takes everything larger. */
+static const uint32_t openalloc_class_sizes[OPENALLOC_NUM_BINS - 1] = {
+    16, 32, 64, 128, 256, 512, 1024, 2048,
+    4096
+};
+
+/* Bin index for sizes up to OPENALLOC_CLASS_LOOKUP_MAX, indexed by (size + 7) >> 3. */
+static const uint8_t openalloc_class_lookup[OPENALLOC_CLASS_LOOKUP_MAX / 8 + 1] = {
+    0, 0, 0, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 3, 3, 3,
+    3, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,
+    4, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5,
+    5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5,
+    5, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
+    6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
+    6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
+    6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
+    6
+};
+
+#endif
@@ -0,0 +1,155 @@
+#ifndef OPENALLOC_INLINE_H
+#define OPENALLOC_INLINE_H
+
+/*
+ * Inline fast path for compile-time constant allocation sizes.
+ *
+ *   struct node* n = openalloc_malloc_const(sizeof(struct node));
+ *
+ * When the size is a constant, the alignment and bin lookup fold away and
+ * the call becomes a pop from that bin's free list, taken only when the head
+ * block fits without splitting. Anything else (non-constant size, empty bin,
+ * head needs splitting, large size) goes through openalloc_malloc().
+ *
+ * The block layout and bin array below are shared with openalloc.c; the
+ * size classes come from the generated openalloc_classes.h.
+ */
+
+#include "openalloc.h"
+#include "openalloc_classes.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define OPENALLOC_INLINE_MAX OPENALLOC_CLASS_MAX
+
+#define OPENALLOC_BLOCK_ALLOC ((size_t)1)
+#define OPENALLOC_BLOCK_PREV_ALLOC ((size_t)2)
+#define OPENALLOC_BLOCK_GUARDED ((size_t)4)
+#define OPENALLOC_BLOCK_FLAGS ((size_t)(OPENALLOC_ALIGN - 1))
+
+/*
+ * A block is one header word, the payload size with the flag bits above in
+ * its low alignment bits, followed by the payload. While a block is free,
+ * its first payload word links it into a bin and its last one repeats the
+ * size; a live block carries nothing but the header.
+ *
+ * OPENALLOC_DEBUG builds put a canary word in front of every header.
+ */
+typedef struct openalloc_block {
+#ifdef OPENALLOC_DEBUG
+    uintptr_t canary;
+#endif
+    size_t header;
+    struct openalloc_block* next;
+} openalloc_block_t;
+
+#define OPENALLOC_HEADER_SIZE offsetof(openalloc_block_t, next)
+
+/*
+ * In-block free-list links are stored as offsets from openalloc_link_base,
+ * which is 0 for ordinary heaps and the mapping start for a persistent one
+ * (see openalloc_init_persistent), so a heap file stays valid wherever it is
+ * mapped next. NULL is stored as 0; offset 0 is the file header, never a
+ * block.
+ *
+ * OPENALLOC_SAFE_LINKING additionally stores each link as
+ * offset ^ (offset of the link >> 12) ^ per-heap secret, as glibc does, so a
+ * use-after-free write cannot plant a usable pointer. Decoded links must be
+ * OPENALLOC_ALIGN-aligned or the allocator aborts.
+ */
+extern uintptr_t openalloc_link_base;
+#define OPENALLOC_LINK_ENCODE(ptr) \
+    ((uintptr_t)(ptr) ? (uintptr_t)(ptr) - openalloc_link_base : (uintptr_t)0)
+#define OPENALLOC_LINK_DECODE(val) \
+    ((openalloc_block_t*)((uintptr_t)(val) ? (uintptr_t)(val) + openalloc_link_base : (uintptr_t)0))
+
+#ifdef OPENALLOC_SAFE_LINKING
+extern uintptr_t openalloc_link_secret;
+#define OPENALLOC_LINK_KEY(pos) \
+    ((((uintptr_t)(pos) - openalloc_link_base) >> 12) ^ openalloc_link_secret)
+#define OPENALLOC_PROTECT(pos, ptr) \
+    ((openalloc_block_t*)(OPENALLOC_LINK_KEY(pos) ^ OPENALLOC_LINK_ENCODE(ptr)))
+#define OPENALLOC_REVEAL(pos, val) \
+    OPENALLOC_LINK_DECODE(OPENALLOC_LINK_KEY(pos) ^ (uintptr_t)(val))
+#define OPENALLOC_LINK_OK(ptr) (((uintptr_t)(ptr) & (OPENALLOC_ALIGN - 1)) == 0)
+#else
+#define OPENALLOC_PROTECT(pos, ptr) ((openalloc_block_t*)OPENALLOC_LINK_ENCODE(ptr))
+#define OPENALLOC_REVEAL(pos, val) OPENALLOC_LINK_DECODE(val)
+#define OPENALLOC_LINK_OK(ptr) 1
+#endif
+
+// Bin for a size, from the table in openalloc_classes.h: one load for
+// sizes up to OPENALLOC_CLASS_LOOKUP_MAX, a short scan above that.
+static inline int openalloc_size_class(size_t size) {
+    if (__builtin_expect(size <= OPENALLOC_CLASS_LOOKUP_MAX, 1)) {
+        return openalloc_class_lookup[(size + 7) >> 3];
+    }
+    int bin = openalloc_class_lookup[OPENALLOC_CLASS_LOOKUP_MAX >> 3];
+    while (bin < OPENALLOC_NUM_BINS - 1 && size > openalloc_class_sizes[bin]) {
+        bin++;
+    }
+    return bin;
+}
+
+// Debug builds route everything through openalloc_malloc() and its checks.
+#if !defined(OPENALLOC_NO_SEG) && !defined(OPENALLOC_DEBUG)
+
+extern openalloc_block_t* openalloc_free_lists[OPENALLOC_NUM_BINS];
+extern int openalloc_background;
+extern size_t openalloc_used;
+extern size_t openalloc_limit_low;
+extern int openalloc_tagging;
+extern size_t openalloc_guard_rate;
+extern int openalloc_numa_enabled;
+
+static inline __attribute__((always_inline)) void* openalloc_malloc_fixed(size_t size) {
+    const size_t rounded = (size + OPENALLOC_ALIGN - 1) & ~(size_t)(OPENALLOC_ALIGN - 1);
+    const size_t aligned = rounded < OPENALLOC_MIN_BLOCK ? OPENALLOC_MIN_BLOCK : rounded;
+    // While a background thread shares the bins, they are the heap lock's;
+    // with guard sampling on, some thread's allocations tagged, or the bins
+    // those of whichever NUMA node ran last, openalloc_malloc decides.
+    if (size == 0 || aligned > OPENALLOC_INLINE_MAX || openalloc_background || openalloc_tagging ||
+        openalloc_guard_rate || openalloc_numa_enabled) {
+        return openalloc_malloc(size);
+    }
+
+    const int bin = openalloc_size_class(aligned);
+    openalloc_block_t* block = openalloc_free_lists[bin];
+
+    // Same split threshold as openalloc_malloc: a block this large would be
+    // split there, so leave it to the out-of-line path. So is a block that
+    // would take usage past openalloc_limit_low, and a corrupted link,
+    // which openalloc_malloc reports.
+    if (__builtin_expect(block != NULL, 1)) {
+        size_t bsize = block->header & ~OPENALLOC_BLOCK_FLAGS;
+        openalloc_block_t* next = OPENALLOC_REVEAL(&block->next, block->next);
+        if (bsize >= aligned && bsize < aligned + OPENALLOC_MIN_BLOCK + OPENALLOC_HEADER_SIZE &&
+            openalloc_used + bsize <= openalloc_limit_low && OPENALLOC_LINK_OK(next)) {
+            uint8_t* data = (uint8_t*)block + OPENALLOC_HEADER_SIZE;
+            openalloc_free_lists[bin] = next;
+            openalloc_used += bsize;
+            __builtin_prefetch(next, 1);
+            block->header |= OPENALLOC_BLOCK_ALLOC;
+            ((openalloc_block_t*)(data + bsize))->header |= OPENALLOC_BLOCK_PREV_ALLOC;
+            return data;
+        }
+    }
+    return openalloc_malloc(size);
+}
+
+#define openalloc_malloc_const(size) \
+    (__builtin_constant_p(size) ? openalloc_malloc_fixed(size) : openalloc_malloc(size))
+
+#else
+
+#define openalloc_malloc_const(size) openalloc_malloc(size)
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
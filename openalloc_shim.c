@@ -0,0 +1,396 @@
+/*
+ * Drop-in malloc replacement for LD_PRELOAD.
+ *
+ * Exports the glibc malloc family on top of a lazily initialized,
+ * mmap-backed growable OpenAlloc heap. The heap itself is single-threaded,
+ * so every entry point takes one process-wide lock.
+ *
+ *   LD_PRELOAD=./libopenalloc.so ./your-binary
+ *
+ * OPENALLOC_GUARD_RATE=N turns on guard-page sampling of one in N
+ * allocations (see openalloc_set_guard_sample_rate), and
+ * OPENALLOC_SLAB_MAX=N serves requests up to N bytes from header-free slabs
+ * (see openalloc_set_slab_max). OPENALLOC_NUMA=1 gives each NUMA node its
+ * own heap (see openalloc_set_numa), and OPENALLOC_HUGE_PAGES=1 backs the
+ * heap with huge pages (see openalloc_set_huge_pages). OPENALLOC_PREFAULT=1
+ * faults the heap in up front (see openalloc_prefault).
+ *
+ * OPENALLOC_PERCPU=1 puts per-CPU caches of small blocks in front of the
+ * lock (x86-64 with rseq only; see below).
+ */
+
+#define _GNU_SOURCE
+#include "openalloc.h"
+#include "openalloc_inline.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) && defined(__has_include)
+#if __has_include(<sys/rseq.h>)
+#include <sys/rseq.h>
+#define SHIM_PERCPU 1
+#endif
+#endif
+
+#define SHIM_EXPORT __attribute__((visibility("default")))
+#define SHIM_SEGMENT_SIZE (64 * 1024 * 1024)
+
+static pthread_mutex_t shim_lock = PTHREAD_MUTEX_INITIALIZER;
+static int shim_ready = 0;
+
+#ifdef SHIM_PERCPU
+/*
+ * Per-CPU caches: for each CPU and each size class up to PERCPU_MAX, a
+ * stack of up to PERCPU_SLOTS blocks that malloc pops and free pushes
+ * without the lock. Each push or pop is a restartable sequence (rseq): the
+ * kernel sends the thread to the abort path if it is preempted or migrated
+ * before the committing store, so nothing else can touch that CPU's stack
+ * meanwhile. Memory grows with the number of CPUs rather than threads, and
+ * a CPU's page of the cache table is only touched once something runs there.
+ *
+ * glibc 2.35+ registers an rseq area for every thread; without that, each
+ * thread registers its own with the raw syscall, and threads that cannot
+ * fall back to the locked path.
+ */
+#define PERCPU_MAX_CPUS 1024
+#define PERCPU_CLASSES 16
+#define PERCPU_SLOTS 31
+#define PERCPU_MAX 256
+#define PERCPU_BATCH 16
+
+typedef struct percpu_stack {
+    size_t count;
+    void* slots[PERCPU_SLOTS];
+} percpu_stack_t;
+
+#define PERCPU_STRIDE (PERCPU_CLASSES * sizeof(percpu_stack_t))
+
+static uint8_t* percpu_cache = NULL;
+static int percpu_classes = 0;     // classes 0..percpu_classes-1 are cached
+
+static __thread struct rseq shim_rseq_area
+    __attribute__((aligned(32), tls_model("initial-exec")));
+static __thread int shim_rseq_state __attribute__((tls_model("initial-exec")));
+
+static inline struct rseq* shim_rseq(void) {
+    if (__rseq_size > 0) {
+        return (struct rseq*)((uint8_t*)__builtin_thread_pointer() + __rseq_offset);
+    }
+    if (__builtin_expect(shim_rseq_state == 0, 0)) {
+        long rc = syscall(SYS_rseq, &shim_rseq_area, sizeof(shim_rseq_area), 0, RSEQ_SIG);
+        shim_rseq_state = rc == 0 ? 1 : -1;
+    }
+    return shim_rseq_state > 0 ? &shim_rseq_area : NULL;
+}
+
+// Pops the top of this CPU's stack at base + cpu * PERCPU_STRIDE; NULL if
+// it is empty, on an unregistered CPU, or if the sequence was aborted.
+static inline void* percpu_pop(struct rseq* rs, uint8_t* base) {
+    void* result;
+    __asm__ __volatile__(
+        ".pushsection __rseq_cs, \"aw\"\n\t"
+        ".balign 32\n\t"
+        "3:\n\t"
+        ".long 0, 0\n\t"
+        ".quad 1f, 2f - 1f, 4f\n\t"
+        ".popsection\n\t"
+        "leaq 3b(%%rip), %%rax\n\t"
+        "movq %%rax, %[cs]\n\t"
+        "1:\n\t"
+        "movl %[cpu], %%eax\n\t"
+        "cmpl %[max_cpus], %%eax\n\t"
+        "jae 4f\n\t"
+        "imulq %[stride], %%rax, %%rax\n\t"
+        "addq %[base], %%rax\n\t"
+        "movq (%%rax), %%rcx\n\t"
+        "testq %%rcx, %%rcx\n\t"
+        "jz 4f\n\t"
+        "movq (%%rax, %%rcx, 8), %[result]\n\t"
+        "decq %%rcx\n\t"
+        "movq %%rcx, (%%rax)\n\t"
+        "2:\n\t"
+        "jmp 5f\n\t"
+        ".byte 0x0f, 0xb9, 0x3d\n\t"
+        ".long 0x53053053\n\t"
+        "4:\n\t"
+        "xorl %k[result], %k[result]\n\t"
+        "5:\n\t"
+        : [result] "=&r"(result), [cs] "=m"(rs->rseq_cs)
+        : [cpu] "m"(rs->cpu_id), [base] "r"(base),
+          [stride] "i"(PERCPU_STRIDE), [max_cpus] "i"(PERCPU_MAX_CPUS)
+        : "rax", "rcx", "memory", "cc");
+    return result;
+}
+
+// Pushes ptr onto this CPU's stack; 0 if it is full or the sequence aborted.
+static inline int percpu_push(struct rseq* rs, uint8_t* base, void* ptr) {
+    int result;
+    __asm__ __volatile__(
+        ".pushsection __rseq_cs, \"aw\"\n\t"
+        ".balign 32\n\t"
+        "3:\n\t"
+        ".long 0, 0\n\t"
+        ".quad 1f, 2f - 1f, 4f\n\t"
+        ".popsection\n\t"
+        "leaq 3b(%%rip), %%rax\n\t"
+        "movq %%rax, %[cs]\n\t"
+        "1:\n\t"
+        "movl %[cpu], %%eax\n\t"
+        "cmpl %[max_cpus], %%eax\n\t"
+        "jae 4f\n\t"
+        "imulq %[stride], %%rax, %%rax\n\t"
+        "addq %[base], %%rax\n\t"
+        "movq (%%rax), %%rcx\n\t"
+        "cmpq %[slots], %%rcx\n\t"
+        "jae 4f\n\t"
+        "movq %[ptr], 8(%%rax, %%rcx, 8)\n\t"
+        "incq %%rcx\n\t"
+        "movq %%rcx, (%%rax)\n\t"
+        "2:\n\t"
+        "movl $1, %[result]\n\t"
+        "jmp 5f\n\t"
+        ".byte 0x0f, 0xb9, 0x3d\n\t"
+        ".long 0x53053053\n\t"
+        "4:\n\t"
+        "xorl %[result], %[result]\n\t"
+        "5:\n\t"
+        : [result] "=&r"(result), [cs] "=m"(rs->rseq_cs)
+        : [cpu] "m"(rs->cpu_id), [base] "r"(base), [ptr] "r"(ptr),
+          [stride] "i"(PERCPU_STRIDE), [max_cpus] "i"(PERCPU_MAX_CPUS),
+          [slots] "i"(PERCPU_SLOTS)
+        : "rax", "rcx", "memory", "cc");
+    return result;
+}
+
+// Called with the lock held, from shim_init_locked, so it must not allocate.
+static void percpu_init_locked(void) {
+    void* mem = mmap(NULL, PERCPU_MAX_CPUS * PERCPU_STRIDE, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (mem == MAP_FAILED) return;
+    
+    int classes = 0;
+    while (classes < PERCPU_CLASSES && classes < OPENALLOC_NUM_BINS - 1 &&
+           openalloc_class_sizes[classes] <= PERCPU_MAX) {
+        classes++;
+    }
+    percpu_cache = mem;
+    percpu_classes = classes;
+}
+
+// Refills this CPU's stack for a class with a batch taken under the lock
+// and returns one more block for the caller.
+static void* percpu_refill(struct rseq* rs, int cls) {
+    void* batch[PERCPU_BATCH];
+    size_t size = openalloc_class_sizes[cls];
+    int n = 0;
+    
+    pthread_mutex_lock(&shim_lock);
+    while (n < PERCPU_BATCH) {
+        void* ptr = openalloc_malloc(size);
+        if (!ptr) break;
+        batch[n++] = ptr;
+    }
+    pthread_mutex_unlock(&shim_lock);
+    if (n == 0) return NULL;
+    
+    uint8_t* base = percpu_cache + cls * sizeof(percpu_stack_t);
+    int kept = 1;
+    while (kept < n && percpu_push(rs, base, batch[kept])) kept++;
+    if (kept < n) {
+        pthread_mutex_lock(&shim_lock);
+        while (kept < n) openalloc_free(batch[kept++]);
+        pthread_mutex_unlock(&shim_lock);
+    }
+    return batch[0];
+}
+
+// Frees ptr plus half of this CPU's full stack under one lock.
+static void percpu_drain(struct rseq* rs, int cls, void* ptr) {
+    void* batch[PERCPU_BATCH];
+    uint8_t* base = percpu_cache + cls * sizeof(percpu_stack_t);
+    int n = 0;
+    while (n < PERCPU_BATCH && (batch[n] = percpu_pop(rs, base)) != NULL) n++;
+    
+    pthread_mutex_lock(&shim_lock);
+    openalloc_free(ptr);
+    while (n > 0) openalloc_free(batch[--n]);
+    pthread_mutex_unlock(&shim_lock);
+}
+
+static void* percpu_malloc(size_t size) {
+    struct rseq* rs = shim_rseq();
+    if (!rs) return NULL;
+    int cls = openalloc_size_class(size);
+    if (cls >= percpu_classes) return NULL;
+    void* ptr = percpu_pop(rs, percpu_cache + cls * sizeof(percpu_stack_t));
+    return ptr ? ptr : percpu_refill(rs, cls);
+}
+
+// Caches ptr if its usable size covers a cached class; 0 if it must be
+// freed the ordinary way.
+static int percpu_free(void* ptr) {
+    struct rseq* rs = shim_rseq();
+    if (!rs) return 0;
+    
+    // The block is the caller's, so its size can be read without the lock.
+    size_t usable = openalloc_usable_size(ptr);
+    int cls = openalloc_size_class(usable);
+    if (cls < OPENALLOC_NUM_BINS - 1 && openalloc_class_sizes[cls] > usable) cls--;
+    if (cls < 0 || cls >= percpu_classes) return 0;
+    
+    if (!percpu_push(rs, percpu_cache + cls * sizeof(percpu_stack_t), ptr)) {
+        percpu_drain(rs, cls, ptr);
+    }
+    return 1;
+}
+#endif
+
+// Must not allocate: this runs from the first malloc call, which can come
+// from the dynamic loader before any constructor has run.
+static int shim_init_locked(void) {
+    if (shim_ready) return 0;
+    if (openalloc_init_growable(SHIM_SEGMENT_SIZE) != 0) return -1;
+    
+    const char* rate = getenv("OPENALLOC_GUARD_RATE");
+    if (rate && *rate) openalloc_set_guard_sample_rate(strtoul(rate, NULL, 10));
+    const char* slab_max = getenv("OPENALLOC_SLAB_MAX");
+    if (slab_max && *slab_max) openalloc_set_slab_max(strtoul(slab_max, NULL, 10));
+    const char* numa = getenv("OPENALLOC_NUMA");
+    if (numa && *numa == '1') openalloc_set_numa(1);
+    const char* huge = getenv("OPENALLOC_HUGE_PAGES");
+    if (huge && *huge == '1') openalloc_set_huge_pages(1);
+    const char* prefault = getenv("OPENALLOC_PREFAULT");
+    if (prefault && *prefault == '1') openalloc_prefault();
+#ifdef SHIM_PERCPU
+    const char* percpu = getenv("OPENALLOC_PERCPU");
+    // Cached blocks skip openalloc_free, so guard sampling would lose its
+    // use-after-free traps; the two are not combined.
+    if (percpu && *percpu == '1' && !(rate && *rate)) percpu_init_locked();
+#endif
+    
+    shim_ready = 1;
+    return 0;
+}
+
+static void shim_fork_prepare(void) {
+    pthread_mutex_lock(&shim_lock);
+}
+
+static void shim_fork_parent(void) {
+    pthread_mutex_unlock(&shim_lock);
+}
+
+static void shim_fork_child(void) {
+    pthread_mutex_init(&shim_lock, NULL);
+}
+
+// Registered from a constructor rather than from malloc, because
+// pthread_atfork may itself allocate.
+__attribute__((constructor))
+static void shim_register_fork_handlers(void) {
+    pthread_atfork(shim_fork_prepare, shim_fork_parent, shim_fork_child);
+}
+
+static void* shim_alloc(size_t alignment, size_t size) {
+    if (size == 0) size = 1;
+#ifdef SHIM_PERCPU
+    if (percpu_cache && alignment == 0 && size <= PERCPU_MAX) {
+        void* ptr = percpu_malloc(size);
+        if (ptr) return ptr;
+    }
+#endif
+
+    pthread_mutex_lock(&shim_lock);
+    void* ptr = NULL;
+    if (shim_init_locked() == 0) {
+        ptr = alignment ? openalloc_memalign(alignment, size) : openalloc_malloc(size);
+    }
+    pthread_mutex_unlock(&shim_lock);
+
+    if (!ptr) errno = ENOMEM;
+    return ptr;
+}
+
+SHIM_EXPORT void* malloc(size_t size) {
+    return shim_alloc(0, size);
+}
+
+SHIM_EXPORT void free(void* ptr) {
+    if (!ptr) return;
+#ifdef SHIM_PERCPU
+    if (percpu_cache && percpu_free(ptr)) return;
+#endif
+    pthread_mutex_lock(&shim_lock);
+    openalloc_free(ptr);
+    pthread_mutex_unlock(&shim_lock);
+}
+
+SHIM_EXPORT void* calloc(size_t nmemb, size_t size) {
+    size_t total;
+    if (__builtin_mul_overflow(nmemb, size, &total)) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    void* ptr = shim_alloc(0, total);
+    if (ptr) memset(ptr, 0, total);
+    return ptr;
+}
+
+SHIM_EXPORT void* realloc(void* ptr, size_t size) {
+    if (!ptr) return shim_alloc(0, size);
+    if (size == 0) {
+        free(ptr);
+        return NULL;
+    }
+
+    pthread_mutex_lock(&shim_lock);
+    void* new_ptr = openalloc_realloc(ptr, size);
+    pthread_mutex_unlock(&shim_lock);
+
+    if (!new_ptr) errno = ENOMEM;
+    return new_ptr;
+}
+
+SHIM_EXPORT int posix_memalign(void** memptr, size_t alignment, size_t size) {
+    if (alignment < sizeof(void*) || (alignment & (alignment - 1))) return EINVAL;
+
+    void* ptr = shim_alloc(alignment, size);
+    if (!ptr) return ENOMEM;
+    *memptr = ptr;
+    return 0;
+}
+
+SHIM_EXPORT void* aligned_alloc(size_t alignment, size_t size) {
+    if (alignment == 0 || (alignment & (alignment - 1))) {
+        errno = EINVAL;
+        return NULL;
+    }
+    return shim_alloc(alignment, size);
+}
+
+SHIM_EXPORT void* memalign(size_t alignment, size_t size) {
+    return aligned_alloc(alignment, size);
+}
+
+SHIM_EXPORT void* valloc(size_t size) {
+    return shim_alloc((size_t)sysconf(_SC_PAGESIZE), size);
+}
+
+SHIM_EXPORT void* pvalloc(size_t size) {
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    if (size > SIZE_MAX - page) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    return shim_alloc(page, (size + page - 1) & ~(page - 1));
+}
+
+SHIM_EXPORT size_t malloc_usable_size(void* ptr) {
+    return openalloc_usable_size(ptr);
+}
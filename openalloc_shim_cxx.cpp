@@ -0,0 +1,75 @@
+/*
+ * C++ operator new/delete for the LD_PRELOAD shim. Everything funnels into
+ * the malloc family exported by openalloc_shim.c.
+ */
+
+#include <cstdlib>
+#include <new>
+
+#define SHIM_EXPORT __attribute__((visibility("default")))
+
+static void* shim_new(std::size_t size) {
+    for (;;) {
+        void* ptr = std::malloc(size);
+        if (ptr) return ptr;
+
+        std::new_handler handler = std::get_new_handler();
+        if (!handler) throw std::bad_alloc();
+        handler();
+    }
+}
+
+static void* shim_new_aligned(std::size_t size, std::align_val_t alignment) {
+    for (;;) {
+        void* ptr = nullptr;
+        if (posix_memalign(&ptr, static_cast<std::size_t>(alignment), size) == 0) return ptr;
+
+        std::new_handler handler = std::get_new_handler();
+        if (!handler) throw std::bad_alloc();
+        handler();
+    }
+}
+
+static void* shim_new_nothrow(std::size_t size) noexcept {
+    try {
+        return shim_new(size);
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+static void* shim_new_aligned_nothrow(std::size_t size, std::align_val_t alignment) noexcept {
+    try {
+        return shim_new_aligned(size, alignment);
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+SHIM_EXPORT void* operator new(std::size_t size) { return shim_new(size); }
+SHIM_EXPORT void* operator new[](std::size_t size) { return shim_new(size); }
+SHIM_EXPORT void* operator new(std::size_t size, const std::nothrow_t&) noexcept { return shim_new_nothrow(size); }
+SHIM_EXPORT void* operator new[](std::size_t size, const std::nothrow_t&) noexcept { return shim_new_nothrow(size); }
+
+SHIM_EXPORT void* operator new(std::size_t size, std::align_val_t al) { return shim_new_aligned(size, al); }
+SHIM_EXPORT void* operator new[](std::size_t size, std::align_val_t al) { return shim_new_aligned(size, al); }
+SHIM_EXPORT void* operator new(std::size_t size, std::align_val_t al, const std::nothrow_t&) noexcept {
+    return shim_new_aligned_nothrow(size, al);
+}
+SHIM_EXPORT void* operator new[](std::size_t size, std::align_val_t al, const std::nothrow_t&) noexcept {
+    return shim_new_aligned_nothrow(size, al);
+}
+
+SHIM_EXPORT void operator delete(void* ptr) noexcept { std::free(ptr); }
+SHIM_EXPORT void operator delete[](void* ptr) noexcept { std::free(ptr); }
+SHIM_EXPORT void operator delete(void* ptr, const std::nothrow_t&) noexcept { std::free(ptr); }
+SHIM_EXPORT void operator delete[](void* ptr, const std::nothrow_t&) noexcept { std::free(ptr); }
+SHIM_EXPORT void operator delete(void* ptr, std::size_t) noexcept { std::free(ptr); }
+SHIM_EXPORT void operator delete[](void* ptr, std::size_t) noexcept { std::free(ptr); }
+
+SHIM_EXPORT void operator delete(void* ptr, std::align_val_t) noexcept { std::free(ptr); }
+SHIM_EXPORT void operator delete[](void* ptr, std::align_val_t) noexcept { std::free(ptr); }
+SHIM_EXPORT void operator delete(void* ptr, std::size_t, std::align_val_t) noexcept { std::free(ptr); }
+SHIM_EXPORT void operator delete[](void* ptr, std::size_t, std::align_val_t) noexcept { std::free(ptr); }
+SHIM_EXPORT void operator delete(void* ptr, std::align_val_t, const std::nothrow_t&) noexcept { std::free(ptr); }
+SHIM_EXPORT void operator delete[](void* ptr, std::align_val_t, const std::nothrow_t&) noexcept { std::free(ptr); }
@@ -0,0 +1,204 @@
+/*
+ * Threaded malloc/free churn for the LD_PRELOAD shim.
+ *
+ *   make run-shim-test
+ *
+ * runs it under LD_PRELOAD=./libopenalloc.so, once plain and once with
+ * OPENALLOC_PERCPU=1. Every block is stamped with its owner and checked
+ * when it is freed, so a block handed out twice, or a per-CPU cache that
+ * loses or duplicates one, shows up as a stamp mismatch. Blocks also
+ * change threads through a shared exchange, and children forked while the
+ * other threads churn must still be able to allocate.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define THREADS 8
+#define OPS 20000
+#define CHILD_OPS 2000
+#define SLOTS 256
+#define EXCHANGE 64
+#define FORKS 8
+
+typedef struct {
+    uint32_t stamp;
+    uint32_t size;
+} tag_t;
+
+static void* exchange[EXCHANGE];
+static volatile int churning = 1;
+
+static inline uint32_t rand_next(uint32_t* state) {
+    *state = *state * 1103515245 + 12345;
+    return *state >> 8;
+}
+
+static void fail(const char* what) {
+    fprintf(stderr, "shim-test: %s\n", what);
+    _exit(1);
+}
+
+// Mostly sizes the per-CPU caches take, some larger ones.
+static size_t pick_size(uint32_t* rng) {
+    uint32_t r = rand_next(rng);
+    return r % 8 == 0 ? 257 + r % 8000 : sizeof(tag_t) + r % 249;
+}
+
+// The stamp goes in the first word and every byte after the tag is set
+// from it, so the check reads the whole block.
+static void* new_block(uint32_t* rng, uint32_t stamp) {
+    size_t size = pick_size(rng);
+    tag_t* tag;
+    switch (rand_next(rng) % 8) {
+    case 0:
+        tag = calloc(1, size);
+        if (tag) {
+            for (size_t i = 0; i < size; i++) {
+                if (((uint8_t*)tag)[i] != 0) fail("calloc block not zeroed");
+            }
+        }
+        break;
+    case 1:
+        if (posix_memalign((void**)&tag, 64, size) != 0) tag = NULL;
+        if (tag && (uintptr_t)tag % 64 != 0) fail("posix_memalign block misaligned");
+        break;
+    case 2:
+        tag = realloc(malloc(8), size);
+        break;
+    default:
+        tag = malloc(size);
+        break;
+    }
+    if (!tag) fail("allocation failed");
+    if (malloc_usable_size(tag) < size) fail("usable size below the request");
+    tag->stamp = stamp;
+    tag->size = (uint32_t)size;
+    memset(tag + 1, (int)(stamp & 0xff), size - sizeof(tag_t));
+    return tag;
+}
+
+static void check_block(const tag_t* tag) {
+    const uint8_t* bytes = (const uint8_t*)(tag + 1);
+    for (size_t i = 0; i < tag->size - sizeof(tag_t); i++) {
+        if (bytes[i] != (tag->stamp & 0xff)) fail("block overwritten while live");
+    }
+}
+
+static void churn(uint32_t seed, int ops, void** slots) {
+    uint32_t rng = seed;
+    for (int i = 0; i < ops; i++) {
+        int k = (int)(rand_next(&rng) % SLOTS);
+        if (slots[k]) {
+            check_block(slots[k]);
+            // Every few frees, hand the block to whichever thread picks up
+            // this exchange slot next.
+            if (rand_next(&rng) % 4 == 0) {
+                slots[k] = __atomic_exchange_n(&exchange[k % EXCHANGE], slots[k], __ATOMIC_ACQ_REL);
+                if (slots[k]) check_block(slots[k]);
+            }
+            free(slots[k]);
+            slots[k] = NULL;
+        } else {
+            slots[k] = new_block(&rng, seed + (uint32_t)i);
+        }
+    }
+    for (int k = 0; k < SLOTS; k++) {
+        if (slots[k]) check_block(slots[k]);
+        free(slots[k]);
+        slots[k] = NULL;
+    }
+}
+
+static void* churn_thread(void* arg) {
+    void* slots[SLOTS] = {0};
+    churn((uint32_t)(uintptr_t)arg, OPS, slots);
+    return NULL;
+}
+
+static void* child_thread(void* arg) {
+    void* slots[SLOTS] = {0};
+    churn((uint32_t)(uintptr_t)arg, CHILD_OPS, slots);
+    return NULL;
+}
+
+static void* background_churn(void* arg) {
+    void* slots[SLOTS] = {0};
+    uint32_t seed = (uint32_t)(uintptr_t)arg;
+    while (churning) churn(seed++, CHILD_OPS, slots);
+    return NULL;
+}
+
+// A child forked while other threads hold the allocator, or have blocks in
+// its per-CPU caches, must still allocate, in its own thread and in new
+// ones.
+static void fork_case(void) {
+    pthread_t busy[2];
+    for (int t = 0; t < 2; t++) {
+        pthread_create(&busy[t], NULL, background_churn, (void*)(uintptr_t)(1000 + t));
+    }
+
+    for (int f = 0; f < FORKS; f++) {
+        pid_t pid = fork();
+        if (pid < 0) fail("fork failed");
+        if (pid == 0) {
+            void* slots[SLOTS] = {0};
+            churn(5000 + (uint32_t)f, CHILD_OPS, slots);
+            pthread_t child;
+            if (pthread_create(&child, NULL, child_thread, (void*)(uintptr_t)(6000 + f)) != 0) {
+                fail("thread in forked child failed");
+            }
+            pthread_join(child, NULL);
+            _exit(0);
+        }
+        int status = 0;
+        waitpid(pid, &status, 0);
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) fail("forked child failed");
+    }
+
+    churning = 0;
+    for (int t = 0; t < 2; t++) pthread_join(busy[t], NULL);
+}
+
+int main(void) {
+    const char* preload = getenv("LD_PRELOAD");
+    if (!preload || !strstr(preload, "libopenalloc")) {
+        fprintf(stderr, "run under LD_PRELOAD=./libopenalloc.so (make run-shim-test)\n");
+        return 1;
+    }
+    const char* percpu = getenv("OPENALLOC_PERCPU");
+    int cached = percpu && *percpu == '1';
+
+    // Requests whose size would wrap fail with ENOMEM.
+    volatile size_t huge = SIZE_MAX - 30;
+    errno = 0;
+    if (malloc(huge) != NULL || errno != ENOMEM) fail("oversized malloc did not fail with ENOMEM");
+    errno = 0;
+    if (memalign(64, huge) != NULL || errno != ENOMEM) fail("oversized memalign did not fail with ENOMEM");
+
+    pthread_t threads[THREADS];
+    for (int t = 0; t < THREADS; t++) {
+        if (pthread_create(&threads[t], NULL, churn_thread, (void*)(uintptr_t)(t + 1)) != 0) {
+            fail("pthread_create failed");
+        }
+    }
+    for (int t = 0; t < THREADS; t++) pthread_join(threads[t], NULL);
+    for (int k = 0; k < EXCHANGE; k++) {
+        if (exchange[k]) check_block(exchange[k]);
+        free(exchange[k]);
+        exchange[k] = NULL;
+    }
+    printf("✓ Shim churn test passed (%d threads%s)\n", THREADS, cached ? ", per-CPU caches" : "");
+
+    fork_case();
+    printf("✓ Shim fork test passed (%d forks%s)\n", FORKS, cached ? ", per-CPU caches" : "");
+    return 0;
+}
@@ -0,0 +1,171 @@
+/*
+ * Size-class table generator for openalloc_classes.h.
+ *
+ *   size-class-gen                       default power-of-two table
+ *   size-class-gen trace.txt [classes]   table fitted to an allocation trace
+ *
+ * The trace is text, one allocation per line: "size" or "size count".
+ * Sizes are rounded to OPENALLOC_ALIGN and those above CLASS_MAX are served
+ * by the unbounded last bin, so only sizes up to CLASS_MAX shape the table.
+ * The bounded classes are chosen by dynamic programming to minimize the
+ * request-weighted slack (class upper bound - request size), which is how
+ * much a block reused from the same class can overshoot the request.
+ *
+ * The header is written to stdout, a fragmentation summary to stderr.
+ */
+
+#include "openalloc.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CLASS_MAX 4096
+#define LOOKUP_MAX 1024
+#define MAX_CLASSES 64
+#define DEFAULT_CLASSES 9
+#define NUM_SIZES (CLASS_MAX / OPENALLOC_ALIGN)
+
+static double counts[NUM_SIZES + 1];
+
+static const char* read_histogram(const char* path) {
+    FILE* f = fopen(path, "r");
+    if (!f) return "cannot open trace";
+
+    char line[256];
+    while (fgets(line, sizeof(line), f)) {
+        unsigned long size;
+        double count = 1;
+        int fields = sscanf(line, "%lu %lf", &size, &count);
+        if (fields < 1 || size == 0) continue;
+
+        size_t aligned = (size + OPENALLOC_ALIGN - 1) & ~(size_t)(OPENALLOC_ALIGN - 1);
+        if (aligned > CLASS_MAX) continue;
+        counts[aligned / OPENALLOC_ALIGN] += count;
+    }
+    fclose(f);
+    return NULL;
+}
+
+static double slack(const size_t* bounds) {
+    double total = 0;
+    int c = 0;
+    for (size_t i = 1; i <= NUM_SIZES; i++) {
+        size_t size = i * OPENALLOC_ALIGN;
+        while (bounds[c] < size) c++;
+        total += counts[i] * (double)(bounds[c] - size);
+    }
+    return total;
+}
+
+// Picks num_bounds class upper bounds, the last one fixed at CLASS_MAX.
+static int fit_bounds(size_t* bounds, int num_bounds) {
+    // candidate upper bounds: every observed size plus CLASS_MAX
+    size_t cand[NUM_SIZES + 1];
+    double w[NUM_SIZES + 2];   // prefix request counts
+    double s[NUM_SIZES + 2];   // prefix request bytes
+    int n = 0;
+
+    w[0] = s[0] = 0;
+    for (size_t i = 1; i <= NUM_SIZES; i++) {
+        if (counts[i] == 0 && i != NUM_SIZES) continue;
+        cand[n] = i * OPENALLOC_ALIGN;
+        w[n + 1] = w[n] + counts[i];
+        s[n + 1] = s[n] + counts[i] * (double)cand[n];
+        n++;
+    }
+    if (num_bounds > n) num_bounds = n;
+
+    static double dp[MAX_CLASSES + 1][NUM_SIZES + 1];
+    static int from[MAX_CLASSES + 1][NUM_SIZES + 1];
+
+    // dp[m][j]: best slack covering cand[0..j-1] with m classes, the last
+    // class topping out at cand[j-1].
+    for (int j = 0; j <= n; j++) {
+        dp[0][j] = j == 0 ? 0 : 1e300;
+    }
+    for (int m = 1; m <= num_bounds; m++) {
+        for (int j = 0; j <= n; j++) {
+            dp[m][j] = 1e300;
+            for (int i = m - 1; i < j; i++) {
+                double cost = dp[m - 1][i] + (double)cand[j - 1] * (w[j] - w[i]) - (s[j] - s[i]);
+                if (cost < dp[m][j]) {
+                    dp[m][j] = cost;
+                    from[m][j] = i;
+                }
+            }
+        }
+    }
+
+    for (int m = num_bounds, j = n; m > 0; m--) {
+        bounds[m - 1] = cand[j - 1];
+        j = from[m][j];
+    }
+    return num_bounds;
+}
+
+static int class_of(const size_t* bounds, int num_bounds, size_t size) {
+    for (int c = 0; c < num_bounds; c++) {
+        if (size <= bounds[c]) return c;
+    }
+    return num_bounds;
+}
+
+static void emit_header(const size_t* bounds, int num_bounds, const char* source) {
+    printf("/* Generated by size-class-gen from %s; do not edit by hand. */\n\n", source);
+    printf("#ifndef OPENALLOC_CLASSES_H\n#define OPENALLOC_CLASSES_H\n\n");
+    printf("#include <stdint.h>\n\n");
+    printf("#define OPENALLOC_NUM_BINS %d\n", num_bounds + 1);
+    printf("#define OPENALLOC_CLASS_MAX %d\n", CLASS_MAX);
+    printf("#define OPENALLOC_CLASS_LOOKUP_MAX %d\n\n", LOOKUP_MAX);
+
+    printf("/* Upper bound of each bounded bin; the last bin takes everything larger. */\n");
+    printf("static const uint32_t openalloc_class_sizes[OPENALLOC_NUM_BINS - 1] = {");
+    for (int c = 0; c < num_bounds; c++) {
+        printf("%s%s%zu", c ? "," : "", c % 8 ? " " : "\n    ", bounds[c]);
+    }
+    printf("\n};\n\n");
+
+    printf("/* Bin index for sizes up to OPENALLOC_CLASS_LOOKUP_MAX, indexed by (size + 7) >> 3. */\n");
+    printf("static const uint8_t openalloc_class_lookup[OPENALLOC_CLASS_LOOKUP_MAX / 8 + 1] = {");
+    for (int i = 0; i <= LOOKUP_MAX / 8; i++) {
+        printf("%s%s%d", i ? "," : "", i % 16 ? " " : "\n    ", class_of(bounds, num_bounds, (size_t)i * 8));
+    }
+    printf("\n};\n\n#endif\n");
+}
+
+int main(int argc, char** argv) {
+    size_t defaults[] = {16, 32, 64, 128, 256, 512, 1024, 2048, 4096};
+    int num_defaults = sizeof(defaults) / sizeof(defaults[0]);
+
+    if (argc < 2) {
+        emit_header(defaults, num_defaults, "defaults");
+        return 0;
+    }
+
+    int num_bounds = argc > 2 ? atoi(argv[2]) : DEFAULT_CLASSES;
+    if (num_bounds < 1 || num_bounds > MAX_CLASSES) {
+        fprintf(stderr, "classes must be between 1 and %d\n", MAX_CLASSES);
+        return 1;
+    }
+
+    const char* err = read_histogram(argv[1]);
+    if (err) {
+        fprintf(stderr, "%s: %s\n", argv[1], err);
+        return 1;
+    }
+
+    size_t bounds[MAX_CLASSES];
+    num_bounds = fit_bounds(bounds, num_bounds);
+
+    double requests = 0;
+    for (size_t i = 1; i <= NUM_SIZES; i++) requests += counts[i];
+    if (requests > 0) {
+        fprintf(stderr, "default table: %.2f bytes slack per request\n",
+                slack(defaults) / requests);
+        fprintf(stderr, "fitted table:  %.2f bytes slack per request (%d classes)\n",
+                slack(bounds) / requests, num_bounds);
+    }
+
+    emit_header(bounds, num_bounds, argv[1]);
+    return 0;
+}
@@ -1,7 +1,16 @@
 #include "openalloc.h"
+#include "openalloc_inline.h"
 #include <stdio.h>
 #include <assert.h>
+#include <pthread.h>
+#include <sched.h>
 #include <string.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
 
 #define HEAP_SIZE (1024 * 1024)
 static unsigned char heap[HEAP_SIZE];
@@ -172,6 +181,1309 @@ static void test_stress(void) {
     printf("✓ Stress test passed\n");
 }
 
+static void test_memalign(void) {
+    openalloc_init(heap, HEAP_SIZE);
+    
+    for (size_t alignment = 16; alignment <= 4096; alignment *= 2) {
+        void* ptr = openalloc_memalign(alignment, 100);
+        assert(ptr != NULL);
+        assert((uintptr_t)ptr % alignment == 0);
+        assert(openalloc_usable_size(ptr) >= 100);
+        memset(ptr, 0xCD, 100);
+        openalloc_free(ptr);
+    }
+    
+    assert(openalloc_memalign(24, 100) == NULL);
+    
+#ifndef OPENALLOC_NO_SEG
+    // Whether or not the block it carves from happens to be aligned
+    // already, the over-allocation goes back to the bins.
+    for (size_t fill = 16; fill <= 16 + 4096; fill += 8) {
+        openalloc_init(heap, HEAP_SIZE);
+        void* pad = openalloc_malloc(fill);
+        void* ptr = openalloc_memalign(4096, 100);
+        assert(ptr != NULL && (uintptr_t)ptr % 4096 == 0);
+        assert(openalloc_usable_size(ptr) < 100 + 64);
+        assert(openalloc_in_use() == openalloc_usable_size(pad) + openalloc_usable_size(ptr));
+        openalloc_free(ptr);
+        openalloc_free(pad);
+        assert(openalloc_check_heap() == 0);
+    }
+#endif
+    
+    printf("✓ Memalign test passed\n");
+}
+
+static void test_growable(void) {
+#ifndef OPENALLOC_NO_SEG
+    assert(openalloc_init_growable(64 * 1024) == 0);
+    
+    void* ptrs[64];
+    for (int i = 0; i < 64; i++) {
+        ptrs[i] = openalloc_malloc(4096);
+        assert(ptrs[i] != NULL);
+        memset(ptrs[i], i, 4096);
+    }
+    
+    void* big = openalloc_malloc(1024 * 1024);
+    assert(big != NULL);
+    memset(big, 0xEE, 1024 * 1024);
+    
+    openalloc_stats_t stats;
+    openalloc_get_stats(&stats);
+    assert(stats.heap_size > 64 * 1024);
+    assert(stats.allocated_blocks == 65);
+    
+    for (int i = 0; i < 64; i++) {
+        openalloc_free(ptrs[i]);
+    }
+    openalloc_free(big);
+    
+    printf("✓ Growable heap test passed\n");
+#else
+    printf("✓ Growable heap test skipped (no-seg allocator)\n");
+#endif
+}
+
+static void test_malloc_const(void) {
+    openalloc_init(heap, HEAP_SIZE);
+    
+    void* ptr = openalloc_malloc_const(24);
+    assert(ptr != NULL);
+    assert((uintptr_t)ptr % OPENALLOC_ALIGN == 0);
+    assert(openalloc_usable_size(ptr) >= 24);
+    openalloc_free(ptr);
+    
+    void* again = openalloc_malloc_const(24);
+#ifndef OPENALLOC_NO_SEG
+    assert(again == ptr);
+#endif
+    assert(again != NULL);
+    
+    void* other = openalloc_malloc_const(20);
+    assert(other != NULL && other != again);
+    
+    openalloc_free(again);
+    openalloc_free(other);
+    
+    printf("✓ Constant-size fast path test passed\n");
+}
+
+static void test_compact_header(void) {
+#ifndef OPENALLOC_NO_SEG
+    openalloc_init(heap, HEAP_SIZE);
+    
+    // One 8-byte header word between neighbouring 16-byte payloads.
+    uint8_t* a = openalloc_malloc(16);
+    uint8_t* b = openalloc_malloc(16);
+    uint8_t* c = openalloc_malloc(1);
+    assert(b - a == 16 + OPENALLOC_HEADER_SIZE);
+    assert(c - b == 16 + OPENALLOC_HEADER_SIZE);
+    assert(openalloc_usable_size(c) == OPENALLOC_MIN_BLOCK);
+    
+    memset(a, 0xAB, 16);
+    memset(b, 0xCD, 16);
+    openalloc_free(b);
+    assert(a[15] == 0xAB);
+    assert(openalloc_malloc(16) == b);
+    
+    openalloc_stats_t stats;
+    openalloc_get_stats(&stats);
+    assert(stats.allocated_blocks == 3);
+    assert(stats.free_blocks == 1);
+    
+    printf("✓ Compact header test passed\n");
+#else
+    printf("✓ Compact header test skipped (no-seg allocator)\n");
+#endif
+}
+
+static void test_deferred_free(void) {
+    openalloc_init(heap, HEAP_SIZE);
+    
+#ifndef OPENALLOC_NO_SEG
+    assert(openalloc_set_deferred_free(1) == 0);
+    
+    void* a = openalloc_malloc(16);
+    void* b = openalloc_malloc(16);
+    void* c = openalloc_malloc(16);
+    void* d = openalloc_malloc(16);
+    openalloc_free(b);
+    openalloc_free(a);
+    openalloc_free(c);
+    
+    // Still queued: nothing has reached the bins yet.
+    void* e = openalloc_malloc_const(16);
+    assert(e != a && e != b && e != c);
+    
+    // a, b and c were freed back to back and come back as one block.
+    openalloc_flush();
+    openalloc_stats_t stats;
+    openalloc_get_stats(&stats);
+    assert(stats.free_blocks == 2);
+    assert(openalloc_malloc(64) == a);
+    
+    // A miss flushes the queue before giving up.
+    openalloc_free(d);
+    openalloc_free(e);
+    void* big = openalloc_malloc(HEAP_SIZE / 2);
+    assert(big != NULL);
+    openalloc_free(big);
+    
+    for (int i = 0; i < 1000; i++) {
+        openalloc_free(openalloc_malloc(i % 200 + 1));
+    }
+    assert(openalloc_set_deferred_free(0) == 0);
+    openalloc_get_stats(&stats);
+    assert(stats.allocated_blocks == 1);
+    
+    printf("✓ Deferred free test passed\n");
+#else
+    assert(openalloc_set_deferred_free(1) == -1);
+    printf("✓ Deferred free test skipped (no-seg allocator)\n");
+#endif
+}
+
+#ifndef OPENALLOC_NO_SEG
+// Runs fn in a child process and reports whether it died with sig.
+static int dies_with(void (*fn)(void*), void* arg, int sig) {
+    pid_t pid = fork();
+    if (pid == 0) {
+        fn(arg);
+        _exit(0);
+    }
+    int status;
+    waitpid(pid, &status, 0);
+    return WIFSIGNALED(status) && WTERMSIG(status) == sig;
+}
+#endif
+
+#ifdef OPENALLOC_DEBUG
+static void double_free(void* ptr) {
+    openalloc_free(ptr);
+    openalloc_free(ptr);
+}
+#endif
+
+#ifdef OPENALLOC_SAFE_LINKING
+static void corrupt_link_and_pop(void* ptr) {
+    *(uintptr_t*)ptr ^= 1;
+    openalloc_malloc(32);
+    openalloc_malloc(32);
+}
+#endif
+
+#ifndef OPENALLOC_NO_SEG
+static void write_byte_104(void* ptr) {
+    ((volatile uint8_t*)ptr)[104] = 1;
+}
+
+static void read_byte_0(void* ptr) {
+    (void)((volatile uint8_t*)ptr)[0];
+}
+#endif
+
+static void test_check_heap(void) {
+    openalloc_init(heap, HEAP_SIZE);
+    assert(openalloc_check_heap() == 0);
+    
+    void* ptrs[64];
+    for (int i = 0; i < 64; i++) {
+        ptrs[i] = openalloc_malloc((size_t)(i * 37 % 500 + 1));
+    }
+    for (int i = 0; i < 64; i += 3) {
+        openalloc_free(ptrs[i]);
+    }
+    assert(openalloc_check_heap() == 0);
+    
+#ifndef OPENALLOC_NO_SEG
+    // Overrun one allocation into the next block's header.
+    openalloc_init(heap, HEAP_SIZE);
+    uint8_t* a = openalloc_malloc(16);
+    uint8_t* b = openalloc_malloc(16);
+    assert(b == a + 16 + OPENALLOC_HEADER_SIZE);
+    uint8_t saved[OPENALLOC_HEADER_SIZE];
+    memcpy(saved, a + 16, sizeof(saved));
+    memset(a + 16, 0, sizeof(saved));
+    assert(openalloc_check_heap() == -1);
+    memcpy(a + 16, saved, sizeof(saved));
+    assert(openalloc_check_heap() == 0);
+#endif
+    
+#ifdef OPENALLOC_DEBUG
+    assert(dies_with(double_free, openalloc_malloc(100), SIGABRT));
+#endif
+    
+    printf("✓ Heap check test passed\n");
+}
+
+static void test_safe_linking(void) {
+#ifdef OPENALLOC_SAFE_LINKING
+    openalloc_init(heap, HEAP_SIZE);
+    
+    void* a = openalloc_malloc(32);
+    void* b = openalloc_malloc(32);
+    void* guard = openalloc_malloc(32);
+    openalloc_free(a);
+    openalloc_free(b);
+    
+    // b's link to a is not stored in the clear, and still decodes.
+    assert(*(void**)b != a);
+    assert(openalloc_malloc(32) == b);
+    openalloc_free(b);
+    
+    // A use-after-free write to the link is caught on the next pop.
+    assert(dies_with(corrupt_link_and_pop, b, SIGABRT));
+    
+    openalloc_free(guard);
+    assert(openalloc_check_heap() == 0);
+    printf("✓ Safe-linking test passed\n");
+#else
+    printf("✓ Safe-linking test skipped (OPENALLOC_SAFE_LINKING not set)\n");
+#endif
+}
+
+static void test_guard_pages(void) {
+    openalloc_init(heap, HEAP_SIZE);
+    
+#ifndef OPENALLOC_NO_SEG
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    assert(openalloc_set_guard_sample_rate(1) == 0);
+    
+    uint8_t* ptr = openalloc_malloc(100);
+    assert(ptr != NULL);
+    assert((ptr < heap || ptr >= heap + HEAP_SIZE));
+    assert(((uintptr_t)ptr + 104) % page == 0);
+    assert(openalloc_usable_size(ptr) == 104);
+    memset(ptr, 0xAA, 104);
+    assert(dies_with(write_byte_104, ptr, SIGSEGV));
+    
+    // Constant-size allocations are sampled too, even with a block
+    // waiting in their bin.
+    assert(openalloc_set_guard_sample_rate(0) == 0);
+    void* warm = openalloc_malloc(24);
+    void* pin = openalloc_malloc(24);
+    openalloc_free(warm);
+    assert(openalloc_set_guard_sample_rate(1) == 0);
+    for (int i = 0; i < 100; i++) {
+        uint8_t* c = openalloc_malloc_const(24);
+        assert(c != NULL && (c < heap || c >= heap + HEAP_SIZE));
+        openalloc_free(c);
+    }
+    
+    openalloc_free(pin);
+    
+    // memalign is never sampled; it carves from the bins.
+    void* aligned = openalloc_memalign(64, 100);
+    assert(aligned != NULL && (uintptr_t)aligned % 64 == 0);
+    openalloc_free(aligned);
+    
+    uint8_t* grown = openalloc_realloc(ptr, 300);
+    assert(grown != NULL && grown[103] == 0xAA);
+    assert(dies_with(read_byte_0, ptr, SIGSEGV));
+    openalloc_free(grown);
+    
+    assert(openalloc_set_guard_sample_rate(0) == 0);
+    ptr = openalloc_malloc(100);
+    assert(ptr >= heap && ptr < heap + HEAP_SIZE);
+    openalloc_free(ptr);
+    assert(openalloc_check_heap() == 0);
+    
+    printf("✓ Guard page test passed\n");
+#else
+    assert(openalloc_set_guard_sample_rate(1) == -1);
+    printf("✓ Guard page test skipped (no-seg allocator)\n");
+#endif
+}
+
+static void test_slabs(void) {
+    openalloc_init(heap, HEAP_SIZE);
+    
+#ifndef OPENALLOC_NO_SEG
+    assert(openalloc_set_slab_max(OPENALLOC_CLASS_MAX + 1) == -1);
+    assert(openalloc_set_slab_max(100) == 0);
+    
+    // Header-free objects of one class sit exactly one class size apart.
+    // The class comes from the table, which make classes may regenerate.
+    size_t class_size = openalloc_class_sizes[openalloc_size_class(40)];
+    uint8_t* ptrs[64];
+    for (int i = 0; i < 64; i++) {
+        ptrs[i] = openalloc_malloc(40);
+        assert(ptrs[i] != NULL);
+        assert(openalloc_usable_size(ptrs[i]) == class_size);
+        memset(ptrs[i], i, 40);
+    }
+    assert((size_t)(ptrs[1] - ptrs[0]) == class_size);
+    assert(openalloc_check_heap() == 0);
+    
+    // Above the cutoff allocations still come from the bins.
+    void* big = openalloc_malloc(200);
+    assert(openalloc_usable_size(big) >= 200);
+    
+    uint8_t* grown = openalloc_realloc(ptrs[5], 1000);
+    assert(grown != NULL && grown[39] == 5);
+    ptrs[5] = grown;
+    
+    for (int i = 0; i < 64; i += 2) {
+        openalloc_free(ptrs[i]);
+    }
+    void* reused = openalloc_malloc(class_size);
+    assert(reused == ptrs[62]);
+    ptrs[62] = reused;
+    assert(openalloc_check_heap() == 0);
+    
+    // Switching slabs off leaves existing objects freeable.
+    assert(openalloc_set_slab_max(0) == 0);
+    for (int i = 1; i < 64; i += 2) {
+        openalloc_free(ptrs[i]);
+    }
+    openalloc_free(ptrs[62]);
+    openalloc_free(big);
+    assert(openalloc_check_heap() == 0);
+    
+    printf("✓ Slab test passed\n");
+#else
+    assert(openalloc_set_slab_max(100) == -1);
+    printf("✓ Slab test skipped (no-seg allocator)\n");
+#endif
+}
+
+static void test_numa(void) {
+    openalloc_init(heap, HEAP_SIZE);
+    openalloc_stats_t stats, node_stats;
+    
+#ifndef OPENALLOC_NO_SEG
+    // Node-local segments need a growable heap.
+    assert(openalloc_set_numa(1) == -1);
+    
+    assert(openalloc_init_growable(64 * 1024) == 0);
+    assert(openalloc_set_numa(1) == 0);
+    assert(openalloc_set_deferred_free(1) == -1);
+    assert(openalloc_set_numa(0) == -1);
+    assert(openalloc_set_slab_max(64) == 0);
+    
+    void* ptrs[128];
+    for (int i = 0; i < 128; i++) {
+        ptrs[i] = openalloc_malloc(i % 2 ? 4096 : 48);
+        assert(ptrs[i] != NULL);
+        memset(ptrs[i], i, i % 2 ? 4096 : 48);
+    }
+    assert(openalloc_check_heap() == 0);
+    
+    // Every region belongs to exactly one node.
+    openalloc_get_stats(&stats);
+    size_t total = 0, blocks = 0;
+    int nodes = 0;
+    while (openalloc_get_node_stats(nodes, &node_stats) == 0) {
+        total += node_stats.heap_size;
+        blocks += node_stats.allocated_blocks;
+        nodes++;
+    }
+    assert(nodes >= 1);
+    assert(total == stats.heap_size && blocks == stats.allocated_blocks);
+    
+    // With nodes to choose between, constant sizes take openalloc_malloc,
+    // which picks the caller's node first.
+#ifndef OPENALLOC_DEBUG
+    assert(openalloc_numa_enabled == (nodes > 1));
+#endif
+    openalloc_free(ptrs[0]);
+    ptrs[0] = openalloc_malloc_const(48);
+    assert(ptrs[0] != NULL);
+    
+    for (int i = 0; i < 128; i++) {
+        openalloc_free(ptrs[i]);
+    }
+    assert(openalloc_check_heap() == 0);
+    
+    printf("✓ NUMA heap test passed (%d node%s)\n", nodes, nodes > 1 ? "s" : "");
+#else
+    assert(openalloc_set_numa(1) == -1);
+    assert(openalloc_get_node_stats(0, &node_stats) == 0);
+    assert(openalloc_get_node_stats(1, &node_stats) == -1);
+    openalloc_get_stats(&stats);
+    assert(node_stats.heap_size == stats.heap_size);
+    printf("✓ NUMA heap test skipped (no-seg allocator)\n");
+#endif
+}
+
+static void test_huge_pages(void) {
+    openalloc_init(heap, HEAP_SIZE);
+    
+#ifndef OPENALLOC_NO_SEG
+    assert(openalloc_init_growable(64 * 1024) == 0);
+    assert(openalloc_set_huge_pages(1) == 0);
+    assert(openalloc_set_slab_max(256) == 0);
+    
+    // Slabs of different classes are packed into one 2 MiB arena.
+    uint8_t* small = openalloc_malloc(16);
+    uint8_t* medium = openalloc_malloc(200);
+    assert(small != NULL && medium != NULL);
+    assert((((uintptr_t)small ^ (uintptr_t)medium) >> 21) == 0);
+    
+    void* big = openalloc_malloc(3 * 1024 * 1024);
+    assert(big != NULL);
+    memset(big, 0x5A, 3 * 1024 * 1024);
+    assert(openalloc_check_heap() == 0);
+    
+    openalloc_free(small);
+    openalloc_free(medium);
+    openalloc_free(big);
+    assert(openalloc_check_heap() == 0);
+    
+    printf("✓ Huge page test passed\n");
+#else
+    assert(openalloc_set_huge_pages(1) == -1);
+    printf("✓ Huge page test skipped (no-seg allocator)\n");
+#endif
+}
+
+static void test_top(void) {
+    openalloc_init(heap, HEAP_SIZE);
+    
+#ifndef OPENALLOC_NO_SEG
+    // Untouched space is a single top block that allocations are cut from
+    // in address order.
+    openalloc_stats_t stats;
+    uint8_t* a = openalloc_malloc(64);
+    uint8_t* b = openalloc_malloc(200);
+    uint8_t* c = openalloc_malloc(64);
+    assert(a != NULL && b > a && c > b);
+    openalloc_get_stats(&stats);
+    assert(stats.free_blocks == 1);
+    
+    // A block freed right in front of the top merges into it; any other
+    // goes to its bin.
+    openalloc_free(c);
+    openalloc_get_stats(&stats);
+    assert(stats.free_blocks == 1);
+    openalloc_free(a);
+    openalloc_get_stats(&stats);
+    assert(stats.free_blocks == 2);
+    assert(openalloc_malloc(64) == a);
+    openalloc_free(b);
+    openalloc_get_stats(&stats);
+    assert(stats.free_blocks == 1 && stats.allocated_blocks == 1);
+    assert(openalloc_check_heap() == 0);
+    
+    // When a growable heap maps a new segment, that becomes the top and
+    // the old one is binned.
+    assert(openalloc_init_growable(64 * 1024) == 0);
+    void* x = openalloc_malloc(40 * 1024);
+    void* y = openalloc_malloc(40 * 1024);
+    assert(x != NULL && y != NULL);
+    openalloc_get_stats(&stats);
+    assert(stats.free_blocks == 2);
+    void* z = openalloc_malloc(16 * 1024);
+    assert((uint8_t*)z > (uint8_t*)x && (uint8_t*)z < (uint8_t*)x + 64 * 1024);
+    assert(openalloc_check_heap() == 0);
+    openalloc_free(y);
+    openalloc_get_stats(&stats);
+    assert(stats.free_blocks == 2);
+    assert(openalloc_check_heap() == 0);
+    
+    printf("✓ Top block test passed\n");
+#else
+    printf("✓ Top block test skipped (no-seg allocator)\n");
+#endif
+}
+
+static void test_lifetime_hints(void) {
+    openalloc_init(heap, HEAP_SIZE);
+    
+#ifndef OPENALLOC_NO_SEG
+    openalloc_stats_t before, stats;
+    openalloc_get_stats(&before);
+    
+    // Each lifetime gets its own chunk; blocks of one lifetime are packed
+    // together in it.
+    uint8_t* s1 = openalloc_malloc_hint(100, OPENALLOC_HINT_SHORT);
+    uint8_t* l1 = openalloc_malloc_hint(100, OPENALLOC_HINT_LONG);
+    uint8_t* p1 = openalloc_malloc_hint(100, OPENALLOC_HINT_PERMANENT);
+    uint8_t* s2 = openalloc_malloc_hint(100, OPENALLOC_HINT_SHORT);
+    uint8_t* plain = openalloc_malloc(100);
+    assert(s1 && l1 && p1 && s2 && plain);
+    assert(s2 > s1 && s2 - s1 < 256);
+    assert(((uintptr_t)s1 >> 14) != ((uintptr_t)l1 >> 14) && ((uintptr_t)l1 >> 14) != ((uintptr_t)p1 >> 14));
+    assert(((uintptr_t)plain >> 14) != ((uintptr_t)s1 >> 14));
+    assert(openalloc_check_heap() == 0);
+    
+    // Freed blocks go back to their own lifetime.
+    openalloc_free(l1);
+    assert(openalloc_malloc(100) != l1);
+    assert(openalloc_malloc_hint(100, OPENALLOC_HINT_LONG) == l1);
+    assert(openalloc_malloc_hint(100, 0) != NULL);
+    
+    // Short-lived churn past one chunk takes more chunks from the heap and
+    // hands them back once they empty, so a second round takes no more.
+    openalloc_free(s1);
+    openalloc_free(s2);
+    static void* churn[2000];
+    size_t allocated[2];
+    for (int round = 0; round < 2; round++) {
+        for (int i = 0; i < 2000; i++) {
+            churn[i] = openalloc_malloc_hint(50 + i % 200, OPENALLOC_HINT_SHORT);
+            assert(churn[i] != NULL && openalloc_usable_size(churn[i]) >= 50 + (size_t)(i % 200));
+            memset(churn[i], 0x5A, 50 + i % 200);
+        }
+        openalloc_get_stats(&stats);
+        assert(stats.heap_size == before.heap_size);
+        assert(openalloc_check_heap() == 0);
+        for (int i = 0; i < 2000; i++) {
+            openalloc_free(churn[i]);
+        }
+        openalloc_get_stats(&stats);
+        allocated[round] = stats.total_allocated;
+    }
+    assert(allocated[1] == allocated[0]);
+    openalloc_free(p1);
+    assert(openalloc_check_heap() == 0);
+    assert(openalloc_compact(0) == 0);
+    
+    printf("✓ Lifetime hint test passed\n");
+#else
+    void* ptr = openalloc_malloc_hint(100, OPENALLOC_HINT_LONG);
+    assert(ptr != NULL);
+    openalloc_free(ptr);
+    printf("✓ Lifetime hint test skipped (no-seg allocator)\n");
+#endif
+}
+
+static void test_reserve(void) {
+    openalloc_init(heap, HEAP_SIZE);
+    
+#ifndef OPENALLOC_NO_SEG
+    assert(openalloc_prefault() == 0);
+    assert(openalloc_reserve(100, 50) == 0);
+    openalloc_stats_t stats;
+    openalloc_get_stats(&stats);
+    assert(stats.free_blocks == 51);
+    
+    // Reserved blocks are handed out lowest address first and none of them
+    // is split again.
+    uint8_t* ptrs[50];
+    for (int i = 0; i < 50; i++) {
+        ptrs[i] = openalloc_malloc(100);
+        assert(ptrs[i] != NULL && (i == 0 || ptrs[i] > ptrs[i - 1]));
+    }
+    openalloc_get_stats(&stats);
+    assert(stats.free_blocks == 1);
+    assert(openalloc_check_heap() == 0);
+    for (int i = 0; i < 50; i++) {
+        openalloc_free(ptrs[i]);
+    }
+    assert(openalloc_reserve(HEAP_SIZE, 1) == -1);
+    assert(openalloc_check_heap() == 0);
+    
+    // A growable heap keeps prefaulting the segments it adds, and slab
+    // sizes are reserved in slabs.
+    assert(openalloc_init_growable(64 * 1024) == 0);
+    assert(openalloc_prefault() == 0);
+    assert(openalloc_set_slab_max(256) == 0);
+    assert(openalloc_reserve(32, 2000) == 0);
+    assert(openalloc_reserve(3000, 100) == 0);
+    void* small = openalloc_malloc(32);
+    void* big = openalloc_malloc(1024 * 1024);
+    assert(small != NULL && big != NULL);
+    assert(openalloc_check_heap() == 0);
+    openalloc_free(small);
+    openalloc_free(big);
+    assert(openalloc_check_heap() == 0);
+    
+    printf("✓ Reserve test passed\n");
+#else
+    assert(openalloc_reserve(100, 50) == -1);
+    printf("✓ Reserve test skipped (no-seg allocator)\n");
+#endif
+}
+
+#ifndef OPENALLOC_NO_SEG
+// List node for the persistent heap test; links are offsets from the
+// mapping so they survive a remap.
+struct pnode {
+    size_t next;
+    int value;
+};
+
+static void sleep_ms(long ms) {
+    struct timespec ts = {ms / 1000, (ms % 1000) * 1000000};
+    nanosleep(&ts, NULL);
+}
+
+static void* map_heap_file(int fd, size_t size) {
+    void* mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    assert(mem != MAP_FAILED);
+    return mem;
+}
+
+static int list_sum(uint8_t* base) {
+    int sum = 0;
+    for (struct pnode* n = openalloc_get_root(); n;
+         n = n->next ? (struct pnode*)(base + n->next) : NULL) {
+        sum += n->value;
+    }
+    return sum;
+}
+#endif
+
+static void test_persistent(void) {
+    openalloc_init(heap, HEAP_SIZE);
+    
+#ifndef OPENALLOC_NO_SEG
+    const size_t size = 1024 * 1024;
+    FILE* file = tmpfile();
+    assert(file != NULL && ftruncate(fileno(file), size) == 0);
+    
+    uint8_t* first = map_heap_file(fileno(file), size);
+    assert(openalloc_init_persistent(first, size) == 0);
+    assert(openalloc_set_slab_max(256) == -1);
+    assert(openalloc_set_guard_sample_rate(100) == -1);
+    assert(openalloc_add_region(heap, HEAP_SIZE) == -1);
+    
+    // Interleave list nodes with blocks that are freed again, so the saved
+    // bins have something in them.
+    struct pnode* head = NULL;
+    void* scratch[100];
+    for (int i = 0; i < 100; i++) {
+        struct pnode* n = openalloc_malloc(sizeof(*n));
+        scratch[i] = openalloc_malloc(48 + i);
+        assert(n != NULL && scratch[i] != NULL);
+        n->next = head ? (size_t)((uint8_t*)head - first) : 0;
+        n->value = i;
+        head = n;
+    }
+    for (int i = 0; i < 100; i += 2) {
+        openalloc_free(scratch[i]);
+    }
+    assert(openalloc_set_root(head) == 0);
+    assert(openalloc_get_root() == head);
+    assert(list_sum(first) == 4950);
+    assert(openalloc_detach() == 0);
+    assert(openalloc_get_root() == NULL);
+    
+    // Reattach at a different address: bins and root come back as saved.
+    uint8_t* second = map_heap_file(fileno(file), size);
+    assert(second != first);
+    assert(openalloc_attach(second, size) == 0);
+    assert(list_sum(second) == 4950);
+    assert(openalloc_check_heap() == 0);
+    openalloc_stats_t stats;
+    openalloc_get_stats(&stats);
+    assert(stats.free_blocks >= 50);
+    void* again = openalloc_malloc(48);
+    assert(again != NULL && (uint8_t*)again >= second && (uint8_t*)again < second + size);
+    
+    // Drop the heap without detaching, as a crash would: attach rebuilds
+    // the bins and the list is still there.
+    uint8_t* third = map_heap_file(fileno(file), size);
+    assert(openalloc_attach(third, size) == 1);
+    assert(openalloc_check_heap() == 0);
+    assert(list_sum(third) == 4950);
+    assert(openalloc_malloc(64 * 1024) != NULL);
+    assert(openalloc_check_heap() == 0);
+    
+    // Detaching stops a background thread before the bins are saved, so
+    // a pass cannot be rewriting them after the file is marked clean.
+    for (int i = 0; i < 100; i++) {
+        scratch[i] = openalloc_malloc(64 + i);
+    }
+    for (int i = 0; i < 100; i += 2) {
+        openalloc_free(scratch[i]);
+    }
+    assert(openalloc_start_background(1) == 0);
+    sleep_ms(3);
+    assert(openalloc_detach() == 0);
+    uint8_t* fourth = map_heap_file(fileno(file), size);
+    assert(openalloc_attach(fourth, size) == 0);
+    assert(openalloc_check_heap() == 0);
+    assert(list_sum(fourth) == 4950);
+    assert(openalloc_detach() == 0);
+    
+    assert(openalloc_attach(heap, HEAP_SIZE) == -1);
+    
+    munmap(first, size);
+    munmap(second, size);
+    munmap(third, size);
+    munmap(fourth, size);
+    fclose(file);
+    printf("✓ Persistent heap test passed\n");
+#else
+    assert(openalloc_init_persistent(heap, HEAP_SIZE) == -1);
+    assert(openalloc_attach(heap, HEAP_SIZE) == -1);
+    printf("✓ Persistent heap test skipped (no-seg allocator)\n");
+#endif
+}
+
+static void test_shared(void) {
+    openalloc_init(heap, HEAP_SIZE);
+    
+#ifndef OPENALLOC_NO_SEG
+    const size_t size = 1024 * 1024;
+    const int count = 1000;
+    FILE* file = tmpfile();
+    assert(file != NULL && ftruncate(fileno(file), size) == 0);
+    
+    uint8_t* parent_map = map_heap_file(fileno(file), size);
+    assert(openalloc_init_shared(parent_map, size) == 0);
+    assert(openalloc_set_deferred_free(1) == -1);
+    assert(openalloc_offset_to_ptr(0) == NULL);
+    assert(openalloc_ptr_to_offset(heap) == 0);
+    
+    int msgs[2];
+    assert(pipe(msgs) == 0);
+    pid_t pid = fork();
+    assert(pid >= 0);
+    if (pid == 0) {
+        // Producer: joins through its own mapping, so its addresses differ
+        // from the parent's, and hands each message over as an offset.
+        close(msgs[0]);
+        uint8_t* child_map = map_heap_file(fileno(file), size);
+        if (child_map == parent_map || openalloc_attach_shared(child_map, size) != 0) _exit(1);
+        for (int i = 0; i < count; i++) {
+            size_t len = 16 + (size_t)i % 300;
+            uint8_t* msg = openalloc_malloc(len);
+            if (!msg) _exit(2);
+            memset(msg, i & 0xff, len);
+            openalloc_free(openalloc_malloc(len));
+            size_t offset = openalloc_ptr_to_offset(msg);
+            if (write(msgs[1], &offset, sizeof(offset)) != (ssize_t)sizeof(offset)) _exit(3);
+        }
+        _exit(openalloc_detach() == 0 ? 0 : 4);
+    }
+    
+    // Consumer: checks each message and frees it, racing the producer.
+    close(msgs[1]);
+    int received = 0;
+    size_t offset;
+    while (read(msgs[0], &offset, sizeof(offset)) == (ssize_t)sizeof(offset)) {
+        uint8_t* msg = openalloc_offset_to_ptr(offset);
+        assert(msg != NULL);
+        for (size_t j = 0; j < 16 + (size_t)received % 300; j++) {
+            assert(msg[j] == (received & 0xff));
+        }
+        void* mine = openalloc_malloc(64);
+        assert(mine != NULL);
+        openalloc_free(msg);
+        openalloc_free(mine);
+        received++;
+    }
+    int status;
+    assert(waitpid(pid, &status, 0) == pid);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    assert(received == count);
+    
+    assert(openalloc_check_heap() == 0);
+    openalloc_stats_t stats;
+    openalloc_get_stats(&stats);
+    assert(stats.allocated_blocks == 0);
+    assert(openalloc_detach() == 0);
+    
+    close(msgs[0]);
+    munmap(parent_map, size);
+    fclose(file);
+    printf("✓ Shared heap test passed\n");
+#else
+    assert(openalloc_init_shared(heap, HEAP_SIZE) == -1);
+    assert(openalloc_offset_to_ptr(4096) == NULL);
+    printf("✓ Shared heap test skipped (no-seg allocator)\n");
+#endif
+}
+
+static int epoch_reader_state;
+
+static void* epoch_reader(void* arg) {
+    (void)arg;
+    assert(openalloc_epoch_enter() == 0);
+    __atomic_store_n(&epoch_reader_state, 1, __ATOMIC_RELEASE);
+    while (__atomic_load_n(&epoch_reader_state, __ATOMIC_ACQUIRE) != 2) sched_yield();
+    openalloc_epoch_exit();
+    return NULL;
+}
+
+static void test_epoch(void) {
+    openalloc_init(heap, HEAP_SIZE);
+    
+    // A retired block outlives the (nested) critical section of its own
+    // thread...
+    assert(openalloc_epoch_enter() == 0);
+    assert(openalloc_epoch_enter() == 0);
+    openalloc_retire(openalloc_malloc(64));
+    openalloc_epoch_exit();
+    assert(openalloc_epoch_reclaim() == 1);
+    openalloc_epoch_exit();
+    assert(openalloc_epoch_reclaim() == 0);
+    
+    // ... and that of a reader in another thread.
+    pthread_t reader;
+    epoch_reader_state = 0;
+    assert(pthread_create(&reader, NULL, epoch_reader, NULL) == 0);
+    while (__atomic_load_n(&epoch_reader_state, __ATOMIC_ACQUIRE) != 1) sched_yield();
+    openalloc_retire(openalloc_malloc(64));
+    assert(openalloc_epoch_reclaim() == 1);
+    __atomic_store_n(&epoch_reader_state, 2, __ATOMIC_RELEASE);
+    pthread_join(reader, NULL);
+    assert(openalloc_epoch_reclaim() == 0);
+    
+#ifndef OPENALLOC_NO_SEG
+    // Retiring far more than the heap holds works, since the limbo is
+    // freed in batches as it goes.
+    openalloc_stats_t before, stats;
+    openalloc_get_stats(&before);
+    for (int i = 0; i < 20000; i++) {
+        void* ptr = openalloc_malloc(64 + i % 100);
+        assert(ptr != NULL);
+        openalloc_retire(ptr);
+    }
+    assert(openalloc_epoch_reclaim() == 0);
+    openalloc_get_stats(&stats);
+    assert(stats.total_allocated == before.total_allocated);
+    assert(openalloc_check_heap() == 0);
+#endif
+    
+    // With no limbo bag to be had inside a critical section, retire hands
+    // the block back. Outside one it waits the epochs out itself.
+    struct rlimit as_limit, no_maps;
+    assert(getrlimit(RLIMIT_AS, &as_limit) == 0);
+    size_t in_use = openalloc_in_use();
+    assert(openalloc_epoch_enter() == 0);
+    no_maps = as_limit;
+    no_maps.rlim_cur = 0;
+    assert(setrlimit(RLIMIT_AS, &no_maps) == 0);
+    void* refused = NULL;
+    for (int i = 0; i < 10000 && !refused; i++) {
+        void* ptr = openalloc_malloc(16);
+        assert(ptr != NULL);
+        if (openalloc_retire(ptr) != 0) refused = ptr;
+    }
+    openalloc_epoch_exit();
+    assert(refused != NULL && openalloc_retire(refused) == 0);
+    assert(setrlimit(RLIMIT_AS, &as_limit) == 0);
+    assert(openalloc_epoch_reclaim() == 0);
+    assert(openalloc_in_use() == in_use);
+    
+    // Blocks still in limbo when the heap is reinitialized go with it.
+    assert(openalloc_epoch_enter() == 0);
+    openalloc_retire(openalloc_malloc(64));
+    openalloc_init(heap, HEAP_SIZE);
+    openalloc_epoch_exit();
+    assert(openalloc_epoch_reclaim() == 0);
+    assert(openalloc_check_heap() == 0);
+    
+    printf("✓ Epoch reclamation test passed\n");
+}
+
+static void test_background(void) {
+    openalloc_init(heap, HEAP_SIZE);
+    
+#ifndef OPENALLOC_NO_SEG
+    // Neighbours freed one by one stay separate blocks until a pass
+    // merges them.
+    static void* ptrs[1000];
+    for (int i = 0; i < 1000; i++) {
+        ptrs[i] = openalloc_malloc(200);
+    }
+    uint8_t* big = openalloc_malloc(256 * 1024);
+    void* pin = openalloc_malloc(64);
+    memset(big, 0xAB, 256 * 1024);
+    for (int i = 0; i < 1000; i += 2) openalloc_free(ptrs[i]);
+    for (int i = 1; i < 1000; i += 2) openalloc_free(ptrs[i]);
+    openalloc_free(big);
+    openalloc_stats_t stats, snapshot;
+    openalloc_get_stats(&stats);
+    assert(stats.free_blocks > 500);
+    assert(openalloc_get_stats_snapshot(&snapshot) == -1);
+    
+    assert(openalloc_start_background(0) == -1);
+    assert(openalloc_start_background(5) == 0);
+    assert(openalloc_start_background(5) == 0);
+    
+    // Foreground calls keep working while passes run.
+    for (int round = 0; round < 50; round++) {
+        for (int i = 0; i < 100; i++) {
+            ptrs[i] = openalloc_malloc(16 + (size_t)(i * 7 % 300));
+            assert(ptrs[i] != NULL);
+        }
+        for (int i = 0; i < 100; i++) openalloc_free(ptrs[i]);
+        sleep_ms(1);
+    }
+    
+    // The big block stays free across passes, so its inner pages go back
+    // to the OS and read as zero.
+    for (int i = 0; i < 2000 && big[128 * 1024] != 0; i++) sleep_ms(1);
+    assert(big[128 * 1024] == 0);
+    
+    // The pass running at the last frees may have stepped past them; the
+    // one after it starts behind them and merges them all.
+    uint64_t passes = openalloc_background_passes();
+    for (int i = 0; i < 2000 && openalloc_background_passes() < passes + 2; i++) sleep_ms(1);
+    assert(openalloc_background_passes() >= passes + 2);
+    
+    openalloc_stop_background();
+    openalloc_get_stats(&stats);
+    assert(stats.free_blocks <= 2);
+    assert(openalloc_get_stats_snapshot(&snapshot) == 0);
+    assert(snapshot.heap_size == stats.heap_size);
+    assert(snapshot.allocated_blocks == stats.allocated_blocks);
+    assert(snapshot.total_allocated == stats.total_allocated);
+    assert(openalloc_check_heap() == 0);
+    openalloc_free(pin);
+    
+    // Reinitializing the heap stops the thread.
+    assert(openalloc_start_background(1000) == 0);
+    openalloc_init(heap, HEAP_SIZE);
+    assert(openalloc_malloc(100) != NULL);
+    assert(openalloc_check_heap() == 0);
+    
+    printf("✓ Background maintenance test passed\n");
+#else
+    assert(openalloc_start_background(10) == -1);
+    printf("✓ Background maintenance test skipped (no-seg allocator)\n");
+#endif
+}
+
+#ifndef OPENALLOC_NO_SEG
+static int soft_calls, hard_calls;
+static void* pressure_cache[16];
+
+// Drops the cache at the hard limit, like a tenant shedding cached data.
+static void on_pressure(int level, size_t in_use, size_t request, void* arg) {
+    assert(in_use == openalloc_in_use() && request > 0 && arg == &soft_calls);
+    if (level == OPENALLOC_PRESSURE_SOFT) {
+        soft_calls++;
+        return;
+    }
+    hard_calls++;
+    for (int i = 0; i < 16; i++) {
+        openalloc_free(pressure_cache[i]);
+        pressure_cache[i] = NULL;
+    }
+}
+#endif
+
+static void test_limits(void) {
+    openalloc_init(heap, HEAP_SIZE);
+    
+#ifndef OPENALLOC_NO_SEG
+    // Every allocation path counts what openalloc_usable_size reports.
+    assert(openalloc_in_use() == 0);
+    void* p = openalloc_malloc(100);
+    assert(openalloc_in_use() == openalloc_usable_size(p));
+    void* q = openalloc_memalign(4096, 300);
+    void* c = openalloc_malloc_const(48);
+    void* h = openalloc_malloc_hint(200, OPENALLOC_HINT_SHORT);
+    void* l = openalloc_malloc_hint(200, OPENALLOC_HINT_LONG);
+    assert(openalloc_in_use() == openalloc_usable_size(p) + openalloc_usable_size(q) + openalloc_usable_size(c) +
+           openalloc_usable_size(h) + openalloc_usable_size(l));
+    p = openalloc_realloc(p, 5000);
+    openalloc_free(q);
+    openalloc_free(c);
+    openalloc_free(h);
+    openalloc_free(l);
+    assert(openalloc_in_use() == openalloc_usable_size(p));
+    openalloc_free(p);
+    assert(openalloc_in_use() == 0);
+    
+    openalloc_init(heap, HEAP_SIZE);
+    assert(openalloc_set_slab_max(256) == 0);
+    size_t charged = openalloc_class_sizes[openalloc_size_class(24)];
+    p = openalloc_malloc(24);
+    openalloc_handle_t hd = openalloc_halloc(1000);
+    assert(openalloc_usable_size(p) == charged);
+    assert(openalloc_in_use() >= charged + 1000 + sizeof(size_t));
+    openalloc_hfree(hd);
+    assert(openalloc_in_use() == charged);
+    openalloc_free(p);
+    assert(openalloc_in_use() == 0);
+    
+    assert(openalloc_set_limits(8192, 4096) == -1);
+    assert(openalloc_set_limits(4096, 8192) == 0);
+    openalloc_set_pressure_callback(on_pressure, &soft_calls);
+    for (int i = 0; i < 16; i++) {
+        pressure_cache[i] = openalloc_malloc(100);
+    }
+    assert(soft_calls == 0 && openalloc_in_use() < 4096);
+    
+    // Past the soft limit the callback fires once, then allocations go on
+    // until the hard limit. There the callback frees the cache and the
+    // request is retried; the next time there is nothing left to free.
+    static void* ptrs[64];
+    int n = 0;
+    while (n < 64 && (ptrs[n] = openalloc_malloc(1000)) != NULL) {
+        n++;
+        assert(openalloc_in_use() <= 8192);
+        assert(hard_calls == 0 || pressure_cache[0] == NULL);
+    }
+    assert(soft_calls == 1 && hard_calls == 2);
+    assert(n == 8);
+    assert(openalloc_in_use() > 4096 && openalloc_in_use() + 1000 > 8192);
+    
+    // Dropping back below the soft limit re-arms it.
+    for (int i = 0; i < n; i++) openalloc_free(ptrs[i]);
+    assert(openalloc_in_use() == 0);
+    ptrs[0] = openalloc_malloc(6000);
+    assert(ptrs[0] != NULL && soft_calls == 2);
+    openalloc_free(ptrs[0]);
+    
+    // Raised at runtime; 0 removes them.
+    assert(openalloc_set_limits(0, 256 * 1024) == 0);
+    assert((ptrs[0] = openalloc_malloc(200 * 1024)) != NULL);
+    assert(openalloc_malloc(200 * 1024) == NULL && hard_calls == 3);
+    assert(openalloc_set_limits(0, 0) == 0);
+    assert((ptrs[1] = openalloc_malloc(200 * 1024)) != NULL);
+    openalloc_free(ptrs[0]);
+    openalloc_free(ptrs[1]);
+    assert(openalloc_check_heap() == 0);
+    
+    // The hard limit holds for what is charged, not what is asked: the
+    // rounded size, the slab class, or a block too small to split.
+    openalloc_init(heap, HEAP_SIZE);
+    assert(openalloc_set_limits(0, 104) == 0);
+    assert(openalloc_malloc(105) == NULL);
+    assert((p = openalloc_malloc(97)) != NULL && openalloc_in_use() == 104);
+    assert(openalloc_malloc(1) == NULL && openalloc_malloc_const(1) == NULL);
+    assert(openalloc_memalign(64, 1) == NULL && openalloc_malloc_hint(1, OPENALLOC_HINT_LONG) == NULL);
+    openalloc_free(p);
+    assert((p = openalloc_malloc_const(104)) != NULL && openalloc_in_use() == 104);
+    openalloc_free(p);
+    q = openalloc_memalign(64, 97);
+    assert(openalloc_in_use() <= 104);
+    openalloc_free(q);
+    
+    openalloc_init(heap, HEAP_SIZE);
+    assert(openalloc_set_slab_max(256) == 0);
+    charged = openalloc_class_sizes[openalloc_size_class(65)];
+    assert(openalloc_set_limits(0, charged - 1) == 0);
+    assert(openalloc_malloc(65) == NULL);
+    assert(openalloc_set_limits(0, charged) == 0);
+    assert((p = openalloc_malloc(65)) != NULL && openalloc_in_use() == charged);
+    assert(openalloc_malloc(1) == NULL);
+    openalloc_free(p);
+    
+    openalloc_init(heap, HEAP_SIZE);
+    p = openalloc_malloc(128);
+    q = openalloc_malloc(16);
+    openalloc_free(p);
+    size_t base = openalloc_in_use();
+    assert(openalloc_set_limits(0, base + 112) == 0);
+    p = openalloc_malloc_const(112);
+    assert(openalloc_in_use() <= base + 112);
+    openalloc_free(p);
+    p = openalloc_malloc(112);
+    assert(openalloc_in_use() <= base + 112);
+    openalloc_free(p);
+    openalloc_free(q);
+    assert(openalloc_in_use() == 0 && openalloc_check_heap() == 0);
+    
+    // Init clears the limits.
+    assert(openalloc_set_limits(0, 4096) == 0);
+    openalloc_init(heap, HEAP_SIZE);
+    assert(openalloc_malloc(8192) != NULL);
+    
+    printf("✓ Heap limits test passed\n");
+#else
+    assert(openalloc_set_limits(0, 4096) == -1);
+    printf("✓ Heap limits test skipped (no-seg allocator)\n");
+#endif
+}
+
+#ifndef OPENALLOC_NO_SEG
+static void* untagged_thread(void* arg) {
+    (void)arg;
+    return openalloc_malloc(100);
+}
+#endif
+
+static void test_tags(void) {
+    openalloc_init(heap, HEAP_SIZE);
+    
+#ifndef OPENALLOC_NO_SEG
+    openalloc_tag_stats_t stats;
+    assert(openalloc_set_tag(OPENALLOC_MAX_TAGS) == -1);
+    assert(openalloc_get_tag_stats(0, &stats) == -1);
+    assert(openalloc_get_tag_stats(1, &stats) == 0 && stats.live_blocks == 0 && stats.heap_bytes == 0);
+    
+    // The thread's tag covers openalloc_malloc, the constant-size path and
+    // realloc; another thread is not tagged.
+    assert(openalloc_set_tag(1) == 0);
+    void* ptrs[10];
+    size_t bytes = 0;
+    for (int i = 0; i < 10; i++) {
+        ptrs[i] = openalloc_malloc(100 + (size_t)i * 50);
+        bytes += openalloc_usable_size(ptrs[i]);
+    }
+    void* c = openalloc_malloc_const(32);
+    bytes += openalloc_usable_size(c);
+    pthread_t thread;
+    void* other;
+    assert(pthread_create(&thread, NULL, untagged_thread, NULL) == 0);
+    pthread_join(thread, &other);
+    assert(openalloc_get_tag_stats(1, &stats) == 0);
+    assert(stats.live_blocks == 11 && stats.live_bytes == bytes);
+    assert(stats.heap_bytes >= 64 * 1024);
+    
+    size_t moved = openalloc_usable_size(ptrs[0]);
+    ptrs[0] = openalloc_realloc(ptrs[0], 20000);
+    assert(openalloc_set_tag(0) == 1);
+    void* untagged = openalloc_malloc(100);
+    void* t2 = openalloc_malloc_tagged(300, 2);
+    openalloc_tag_stats_t stats2;
+    assert(openalloc_get_tag_stats(1, &stats) == 0 && stats.live_blocks == 11);
+    assert(stats.live_bytes == bytes - moved + openalloc_usable_size(ptrs[0]));
+    assert(openalloc_get_tag_stats(2, &stats2) == 0 && stats2.live_blocks == 1);
+    assert(openalloc_in_use() ==
+           stats.live_bytes + stats2.live_bytes + openalloc_usable_size(untagged) + openalloc_usable_size(other));
+    
+    // Free finds the tag from the page map, whichever thread frees.
+    for (int i = 0; i < 10; i++) openalloc_free(ptrs[i]);
+    openalloc_free(c);
+    openalloc_free(t2);
+    assert(openalloc_get_tag_stats(1, &stats) == 0 && stats.live_blocks == 0 && stats.live_bytes == 0);
+    assert(openalloc_get_tag_stats(2, &stats) == 0 && stats.live_blocks == 0);
+    assert(openalloc_check_heap() == 0);
+    openalloc_free(untagged);
+    openalloc_free(other);
+    assert(openalloc_in_use() == 0);
+    
+    // Init clears the counts but not the thread's tag.
+    assert(openalloc_set_tag(3) == 0);
+    openalloc_malloc(64);
+    openalloc_init(heap, HEAP_SIZE);
+    assert(openalloc_get_tag_stats(3, &stats) == 0 && stats.live_blocks == 0 && stats.heap_bytes == 0);
+    openalloc_malloc(64);
+    assert(openalloc_get_tag_stats(3, &stats) == 0 && stats.live_blocks == 1);
+    assert(openalloc_set_tag(0) == 3);
+    assert(openalloc_check_heap() == 0);
+    
+    printf("✓ Allocation tags test passed\n");
+#else
+    assert(openalloc_set_tag(1) == -1);
+    assert(openalloc_set_tag(0) == 0);
+    printf("✓ Allocation tags test skipped (no-seg allocator)\n");
+#endif
+}
+
+static void test_size_classes(void) {
+    int prev = 0;
+    for (size_t size = 1; size <= 2 * OPENALLOC_CLASS_MAX; size++) {
+        int bin = openalloc_size_class(size);
+        assert(bin >= prev && bin < OPENALLOC_NUM_BINS);
+        if (bin < OPENALLOC_NUM_BINS - 1) {
+            assert(size <= openalloc_class_sizes[bin]);
+        }
+        if (bin > 0) {
+            assert(size > openalloc_class_sizes[bin - 1]);
+        }
+        prev = bin;
+    }
+    assert(openalloc_size_class(OPENALLOC_CLASS_MAX + 1) == OPENALLOC_NUM_BINS - 1);
+    
+    printf("✓ Size class table test passed\n");
+}
+
+static void test_handles(void) {
+    openalloc_init(heap, HEAP_SIZE);
+    
+#ifndef OPENALLOC_NO_SEG
+    static openalloc_handle_t handles[8192];
+    assert(openalloc_halloc(0) == 0);
+    
+    // Fill the heap with handle blocks, one plain block among them.
+    int count = 0;
+    void* plain = NULL;
+    while (count < 8192) {
+        if (count == 100) plain = openalloc_malloc(200);
+        handles[count] = openalloc_halloc(200);
+        if (!handles[count]) break;
+        memset(openalloc_hlock(handles[count]), count & 0xff, 200);
+        openalloc_hunlock(handles[count]);
+        count++;
+    }
+    assert(count > 1000 && plain != NULL);
+    
+    // Free every other one: lots of free space, none of it contiguous.
+    for (int i = 0; i < count; i += 2) {
+        openalloc_hfree(handles[i]);
+    }
+    assert(openalloc_hlock(handles[0]) == NULL);
+    assert(openalloc_malloc(64 * 1024) == NULL);
+    
+    void* pinned = openalloc_hlock(handles[501]);
+    
+    // A pass in bounded steps leaves a consistent heap after each one, and
+    // allocating in the middle of it still works.
+    int steps = 0;
+    while (openalloc_compact(1) != 0) {
+        assert(openalloc_check_heap() == 0);
+        if (steps++ == 2) {
+            void* small = openalloc_malloc(100);
+            assert(small != NULL);
+            openalloc_free(small);
+        }
+    }
+    assert(steps > 0);
+    assert(openalloc_compact(0) == 0);
+    assert(openalloc_check_heap() == 0);
+    
+    assert(openalloc_hlock(handles[501]) == pinned);
+    openalloc_hunlock(handles[501]);
+    openalloc_hunlock(handles[501]);
+    for (int i = 1; i < count; i += 2) {
+        uint8_t* data = openalloc_hlock(handles[i]);
+        assert(data != NULL && data[0] == (i & 0xff) && data[199] == (i & 0xff));
+        openalloc_hunlock(handles[i]);
+    }
+    
+    void* big = openalloc_malloc(64 * 1024);
+    assert(big != NULL);
+    openalloc_free(big);
+    openalloc_free(plain);
+    for (int i = 1; i < count; i += 2) {
+        openalloc_hfree(handles[i]);
+    }
+    assert(openalloc_check_heap() == 0);
+    
+    printf("✓ Handle and compaction test passed\n");
+#else
+    assert(openalloc_halloc(64) == 0);
+    assert(openalloc_compact(0) == 0);
+    printf("✓ Handle and compaction test skipped (no-seg allocator)\n");
+#endif
+}
+
+// Requests whose size plus alignment and headers would wrap are refused
+// rather than served from a block the wrapped size fits in.
+static void test_oversized(void) {
+    openalloc_init(heap, HEAP_SIZE);
+    
+    assert(openalloc_malloc(SIZE_MAX) == NULL);
+    assert(openalloc_malloc(SIZE_MAX - 30) == NULL);
+    assert(openalloc_memalign(64, SIZE_MAX - 40) == NULL);
+    assert(openalloc_memalign(4096, SIZE_MAX / 2) == NULL);
+    void* ptr = openalloc_malloc(64);
+    assert(ptr != NULL);
+    assert(openalloc_realloc(ptr, SIZE_MAX - 3) == NULL);
+    openalloc_free(ptr);
+    
+#ifndef OPENALLOC_NO_SEG
+    // A growable heap must not go looking for a segment that size.
+    assert(openalloc_init_growable(64 * 1024) == 0);
+    assert(openalloc_malloc(SIZE_MAX) == NULL);
+    assert(openalloc_malloc(SIZE_MAX - 30) == NULL);
+    assert(openalloc_memalign(64, SIZE_MAX - 40) == NULL);
+    assert(openalloc_malloc_hint(SIZE_MAX - 30, OPENALLOC_HINT_LONG) == NULL);
+    assert(openalloc_malloc_tagged(SIZE_MAX - 30, 1) == NULL);
+    assert(openalloc_halloc(SIZE_MAX - 4) == 0);
+    assert(openalloc_reserve(SIZE_MAX - 30, 1) == -1);
+    assert(openalloc_in_use() == 0);
+    
+    ptr = openalloc_malloc(64);
+    assert(ptr != NULL);
+    openalloc_free(ptr);
+#endif
+    
+    printf("✓ Oversized request test passed\n");
+}
+
 static void test_oom(void) {
     openalloc_init(heap, HEAP_SIZE);
     
@@ -194,6 +1506,29 @@ int main(void) {
     test_usable_size();
     test_large_allocations();
     test_stress();
+    test_memalign();
+    test_growable();
+    test_malloc_const();
+    test_compact_header();
+    test_deferred_free();
+    test_check_heap();
+    test_safe_linking();
+    test_guard_pages();
+    test_slabs();
+    test_numa();
+    test_huge_pages();
+    test_top();
+    test_lifetime_hints();
+    test_reserve();
+    test_persistent();
+    test_shared();
+    test_handles();
+    test_epoch();
+    test_background();
+    test_limits();
+    test_tags();
+    test_size_classes();
+    test_oversized();
     test_oom();
     
     printf("\n✓ All tests passed!\n");